@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ *  Userspace interface of the prismriver guitar driver.
+ *
+ *  Every bound guitar gets a character device, /dev/prismriverN, from
+ *  which fixed-size struct prismriver_event records are read. Any number
+ *  of consumers may open it; each one gets the full event stream and its
+ *  own wakeup moderation settings.
+ *
+ *  The event ring itself can also be mapped read-only, see struct
+ *  prismriver_ring, so that consumers can poll it without any syscall.
+ */
+
+#ifndef _PRISMRIVER_H
+#define _PRISMRIVER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Fret and button bits of prismriver_frame.buttons */
+#define PRISMRIVER_BTN_GREEN	(1 << 0)
+#define PRISMRIVER_BTN_RED	(1 << 1)
+#define PRISMRIVER_BTN_YELLOW	(1 << 2)
+#define PRISMRIVER_BTN_BLUE	(1 << 3)
+#define PRISMRIVER_BTN_ORANGE	(1 << 4)
+#define PRISMRIVER_BTN_SELECT	(1 << 5)
+#define PRISMRIVER_BTN_START	(1 << 6)
+#define PRISMRIVER_BTN_PS	(1 << 7)
+
+#define PRISMRIVER_FRET_MASK	0x1f
+
+/* prismriver_frame.strum */
+#define PRISMRIVER_STRUM_NONE	0
+#define PRISMRIVER_STRUM_UP	1
+#define PRISMRIVER_STRUM_DOWN	2
+
+/* prismriver_event.type */
+#define PRISMRIVER_EV_FRAME	1
+#define PRISMRIVER_EV_NOTE	2
+#define PRISMRIVER_EV_JUDGE	3
+
+#define PRISMRIVER_EV_MASK(type)	(1U << (type))
+#define PRISMRIVER_EV_MASK_ALL		(~0U)
+
+/*
+ * prismriver_event.flags: PRISMRIVER_EVF_EDGE is set when a fret, button
+ * or the strum bar changed. Frames without it only carry new whammy or
+ * tilt values. Note events always carry it.
+ */
+#define PRISMRIVER_EVF_EDGE	(1 << 0)
+
+struct prismriver_frame {
+	__u16 buttons;
+	__u8 strum;
+	__u8 whammy;
+	__u16 tilt;
+	__u16 reserved[5];
+};
+
+/*
+ * One note played: emitted on every strum, with the frets held and the
+ * whammy and tilt positions at the moment of the strum. The event time is
+ * the time of the report carrying the strum.
+ */
+struct prismriver_note {
+	__u8 frets;
+	__u8 direction;		/* PRISMRIVER_STRUM_UP or _DOWN */
+	__u8 whammy;
+	__u8 reserved0;
+	__u16 tilt;
+	__u16 reserved[5];
+};
+
+/* prismriver_judgement.result */
+#define PRISMRIVER_JUDGE_HIT		1
+#define PRISMRIVER_JUDGE_MISS		2
+#define PRISMRIVER_JUDGE_OVERSTRUM	3
+
+/*
+ * Verdict of the chart judge. A hit or an overstrum on a chart note has
+ * the note's @id, the played frets and the strum's offset from the note
+ * time. A miss is emitted once the hit window of a note has passed
+ * without a matching strum; its event time is the end of that window.
+ * A strum with no note in its window is an overstrum with @id set to
+ * PRISMRIVER_JUDGE_NO_NOTE.
+ */
+#define PRISMRIVER_JUDGE_NO_NOTE	(~0U)
+
+struct prismriver_judgement {
+	__u8 result;
+	__u8 frets;
+	__u8 expected_frets;
+	__u8 reserved0;
+	__s32 offset_ns;
+	__u32 id;
+	__u32 reserved;
+};
+
+struct prismriver_event {
+	__u64 time_ns;		/* CLOCK_MONOTONIC */
+	__u32 seq;
+	__u16 type;
+	__u16 flags;
+	union {
+		struct prismriver_frame frame;
+		struct prismriver_note note;
+		struct prismriver_judgement judgement;
+		__u8 data[16];
+	};
+};
+
+/*
+ * Wakeup moderation, in the spirit of NIC interrupt coalescing. Edge
+ * frames always wake the consumer immediately. Analog-only frames are
+ * held back until @frames of them are pending or @usecs have elapsed
+ * since the previous wakeup, whichever comes first. Zero disables the
+ * respective limit; both zero (the default) wakes on every frame.
+ */
+struct prismriver_coalesce {
+	__u32 usecs;
+	__u32 frames;
+};
+
+/*
+ * Shared event ring, mapped with
+ *
+ *	mmap(NULL, PRISMRIVER_RING_MMAP_SIZE, PROT_READ, MAP_SHARED, fd, 0)
+ *
+ * The driver writes events[head % size] and then publishes the new head
+ * with release semantics. A consumer loads head with acquire semantics,
+ * copies out the events between its own position and head, and loads head
+ * again: if it moved more than size past the consumer's position while
+ * copying, the copy may be torn and the consumer has to resynchronise.
+ *
+ * PRISMRIVER_RING_BUSY_POLL in flags mirrors the busy_poll sysfs attribute
+ * of the guitar. While set, the driver does not wake blocked readers at
+ * all and consumers are expected to spin on head.
+ */
+#define PRISMRIVER_RING_SIZE	256
+
+#define PRISMRIVER_RING_BUSY_POLL	(1 << 0)
+
+struct prismriver_ring {
+	__u32 head;
+	__u32 size;
+	__u32 flags;
+	__u32 reserved[13];
+	struct prismriver_event events[];
+};
+
+#define PRISMRIVER_RING_MMAP_SIZE \
+	(sizeof(struct prismriver_ring) + \
+	 PRISMRIVER_RING_SIZE * sizeof(struct prismriver_event))
+
+/*
+ * Chart judge. PRISMRIVER_IOC_CHART_RESET empties the guitar's chart
+ * window and sets the hit window in microseconds on each side of a note;
+ * zero turns judging off. PRISMRIVER_IOC_CHART_APPEND then queues the
+ * upcoming notes, in ascending time order and later than any note already
+ * queued. At most PRISMRIVER_CHART_MAX notes can be pending at a time,
+ * judged notes free their slot. Note times are CLOCK_MONOTONIC, like
+ * event times, and every strum is judged against the time of the report
+ * it arrived in.
+ */
+#define PRISMRIVER_CHART_MAX	64
+#define PRISMRIVER_CHART_BATCH	32
+
+struct prismriver_chart_note {
+	__u64 time_ns;
+	__u32 id;
+	__u8 frets;
+	__u8 reserved[3];
+};
+
+struct prismriver_chart {
+	__u32 count;
+	__u32 reserved;
+	struct prismriver_chart_note notes[PRISMRIVER_CHART_BATCH];
+};
+
+/*
+ * Keyboard translation. Every guitar also has a keyboard input device,
+ * which types what the profile set with PRISMRIVER_IOC_SET_KEYMAP says.
+ * A profile has up to PRISMRIVER_LAYERS_MAX layers, e.g. one for
+ * gameplay, one for menus and one for practice, of which one is active;
+ * the profile starts out in layer 0. In each layer:
+ *
+ *  - @keys gives the key held down while an input is, for each of the
+ *    PRISMRIVER_KEY_INPUTS inputs: the PRISMRIVER_BTN_* bits, then
+ *    PRISMRIVER_KEY_STRUM_UP and PRISMRIVER_KEY_STRUM_DOWN. 0 is no key.
+ *
+ *  - a combo acts once when all of its @inputs become held. With @layer
+ *    0 it taps its key sequence: the keys are pressed in order and then
+ *    released in reverse order, so that e.g. KEY_LEFTCTRL, KEY_S types
+ *    Ctrl+S. With @layer set to PRISMRIVER_COMBO_LAYER(n) it makes layer
+ *    n the active one instead; inputs held at that moment type nothing
+ *    until they are released. While a combo is held, its inputs type
+ *    none of their own keys. When several combos are held, the one with
+ *    the most inputs wins, then the first one. Combos are chords, held
+ *    in any order; an ordered sequence is a layer switch followed by a
+ *    combo of that layer, e.g. Select then Orange.
+ *
+ *  - the keys of the inputs in @repeat repeat while held, e.g. the strum
+ *    bar in a menu layer. As on a keyboard, only the key pressed last
+ *    repeats. No other key ever repeats, so that frets held through a
+ *    sustain type exactly one press and one release.
+ *
+ * The keyboard device advertises EV_REP, but does the repeating itself
+ * along these rules rather than leaving it to the input core. Its delay
+ * and period start out at 250 and 33 ms and can be changed with
+ * EVIOCSREP like those of any keyboard, or by a profile: a non-zero
+ * @repeat_delay_ms or @repeat_period_ms is applied when it is set. A
+ * period of 0 turns repeat off.
+ *
+ * The profile also caps how often the whammy and tilt axes of the
+ * guitar's joystick device change, at @whammy_rate_hz and @tilt_rate_hz,
+ * 0 for no cap. A change that comes sooner after the previous one is
+ * held back, keeping only the latest value, which is emitted at the end
+ * of the window so that the final position is never lost.
+ *
+ * Keys are KEY_* codes from KEY_ESC to PRISMRIVER_KEY_MAX. All layers are
+ * compiled by the driver when the profile is set, so neither their size
+ * nor switching between them changes the cost of a report. Setting a
+ * profile releases the keys held under the old one at once and stops
+ * their repeat. The default profile is empty.
+ */
+#define PRISMRIVER_KEY_INPUTS		10
+#define PRISMRIVER_KEY_STRUM_UP		(1 << 8)
+#define PRISMRIVER_KEY_STRUM_DOWN	(1 << 9)
+#define PRISMRIVER_KEY_MAX		248	/* KEY_MICMUTE */
+
+#define PRISMRIVER_COMBO_MAX		16
+#define PRISMRIVER_COMBO_KEYS		6
+
+#define PRISMRIVER_LAYERS_MAX		3
+#define PRISMRIVER_LAYER_GAMEPLAY	0
+#define PRISMRIVER_LAYER_MENU		1
+#define PRISMRIVER_LAYER_PRACTICE	2
+
+#define PRISMRIVER_COMBO_LAYER(n)	((n) + 1)
+
+struct prismriver_combo {
+	__u16 inputs;		/* PRISMRIVER_BTN_* and PRISMRIVER_KEY_STRUM_* */
+	__u8 count;		/* of @keys, 0 for a layer switch */
+	__u8 layer;
+	__u16 keys[PRISMRIVER_COMBO_KEYS];
+};
+
+struct prismriver_layer {
+	__u16 keys[PRISMRIVER_KEY_INPUTS];
+	__u16 combo_count;
+	__u16 repeat;		/* inputs whose key repeats */
+	struct prismriver_combo combos[PRISMRIVER_COMBO_MAX];
+};
+
+struct prismriver_keymap {
+	__u16 layer_count;
+	__u16 repeat_delay_ms;
+	__u16 repeat_period_ms;
+	__u16 whammy_rate_hz;
+	__u16 tilt_rate_hz;
+	__u16 reserved[3];
+	struct prismriver_layer layers[PRISMRIVER_LAYERS_MAX];
+};
+
+/*
+ * Flight recorder dump, read from prismriver/<device>/flight_recorder in
+ * debugfs: a header followed by @count records, oldest first. Reports
+ * longer than PRISMRIVER_RAW_MAX are truncated, @size keeps their length.
+ */
+#define PRISMRIVER_RECORDER_MAGIC	0x52465250	/* "PRFR" */
+#define PRISMRIVER_RECORDER_VERSION	1
+#define PRISMRIVER_RAW_MAX		32
+
+struct prismriver_recorder_header {
+	__u32 magic;
+	__u16 version;
+	__u16 record_size;
+	__u32 count;
+	__u32 reserved;
+};
+
+struct prismriver_raw_record {
+	__u64 time_ns;		/* CLOCK_MONOTONIC */
+	__u32 seq;
+	__u16 size;
+	__u16 reserved;
+	__u8 data[PRISMRIVER_RAW_MAX];
+};
+
+/*
+ * Capture file, the corpus format shared by the capture tools and the
+ * report injector. All fields are little endian. The header is followed
+ * by @rdesc_size bytes of report descriptor and then by @count records
+ * of @report_size + 4 bytes each: the time since the previous record in
+ * nanoseconds, saturated at 0xffffffff, and the report bytes. Captures
+ * only hold reports of one size, which is all the guitar sends.
+ */
+#define PRISMRIVER_CAP_MAGIC		0x50435250	/* "PRCP" */
+#define PRISMRIVER_CAP_VERSION		1
+
+struct prismriver_cap_header {
+	__u32 magic;
+	__u16 version;
+	__u16 header_size;
+	__u16 bus;
+	__u16 vendor;
+	__u16 product;
+	__u16 report_size;
+	__u16 rdesc_size;
+	__u16 reserved;
+	__u32 count;
+};
+
+#define PRISMRIVER_IOC_MAGIC	'P'
+
+#define PRISMRIVER_IOC_GET_COALESCE	_IOR(PRISMRIVER_IOC_MAGIC, 0x01, struct prismriver_coalesce)
+#define PRISMRIVER_IOC_SET_COALESCE	_IOW(PRISMRIVER_IOC_MAGIC, 0x02, struct prismriver_coalesce)
+
+/*
+ * Subscription mask of a consumer, a set of PRISMRIVER_EV_MASK() bits.
+ * Events of other types are neither read nor cause wakeups. Mapped ring
+ * consumers see every event regardless.
+ */
+#define PRISMRIVER_IOC_GET_MASK		_IOR(PRISMRIVER_IOC_MAGIC, 0x03, __u32)
+#define PRISMRIVER_IOC_SET_MASK		_IOW(PRISMRIVER_IOC_MAGIC, 0x04, __u32)
+
+#define PRISMRIVER_IOC_CHART_RESET	_IOW(PRISMRIVER_IOC_MAGIC, 0x05, __u32)
+#define PRISMRIVER_IOC_CHART_APPEND	_IOW(PRISMRIVER_IOC_MAGIC, 0x06, struct prismriver_chart)
+
+#define PRISMRIVER_IOC_SET_KEYMAP	_IOW(PRISMRIVER_IOC_MAGIC, 0x07, struct prismriver_keymap)
+
+#endif /* _PRISMRIVER_H */
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Report decoder of the prismriver guitar driver, see prismriver_core.h.
+ */
+
+#include "prismriver_core.h"
+
+#define GUITAR_TILT_MASK 0x3ff
+#define GUITAR_HAT_UP 0
+#define GUITAR_HAT_DOWN 4
+
+/*
+ * Layout of the 27 byte input report sent by the PS3 guitar dongle. Frets
+ * and face buttons live in the first two bytes, the strum bar is reported
+ * through the hat switch, the whammy bar as the right stick X (Z) axis
+ * and the tilt sensor as the 10 bit X accelerometer. The hat is the low
+ * nibble of its byte, followed by 4 bits of padding.
+ *
+ * decode_default() hard-codes the same offsets, keep both in sync.
+ */
+#define GUITAR_HAT_OFFSET 2
+#define GUITAR_WHAMMY_OFFSET 5
+#define GUITAR_TILT_OFFSET 19
+
+const struct prismriver_layout prismriver_default_layout = {
+	.count = 11,
+	.size = PRISMRIVER_REPORT_SIZE,
+	.report_size = PRISMRIVER_REPORT_SIZE,
+	.fields = {
+		{ 1, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_GREEN },
+		{ 2, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_RED },
+		{ 3, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_YELLOW },
+		{ 0, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_BLUE },
+		{ 4, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_ORANGE },
+		{ 8, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_SELECT },
+		{ 9, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_START },
+		{ 12, 1, PRISMRIVER_FIELD_BUTTON, PRISMRIVER_BTN_PS },
+		{ 16, 4, PRISMRIVER_FIELD_HAT, 0 },
+		{ 40, 8, PRISMRIVER_FIELD_WHAMMY, 0 },
+		{ 152, 16, PRISMRIVER_FIELD_TILT, 0 },
+	},
+};
+
+/* HID usages the guitar reports its controls with, page << 16 | id */
+#define GUITAR_USAGE_PAGE_BUTTON	0x00090000
+#define GUITAR_USAGE_HAT		0x00010039
+#define GUITAR_USAGE_Z			0x00010032
+#define GUITAR_USAGE_TILT		0xff00002c
+
+/* Decoder targets of the guitar's button usages, by button number */
+static const __u16 guitar_usage_buttons[] = {
+	[1] = PRISMRIVER_BTN_BLUE,
+	[2] = PRISMRIVER_BTN_GREEN,
+	[3] = PRISMRIVER_BTN_RED,
+	[4] = PRISMRIVER_BTN_YELLOW,
+	[5] = PRISMRIVER_BTN_ORANGE,
+	[9] = PRISMRIVER_BTN_SELECT,
+	[10] = PRISMRIVER_BTN_START,
+	[13] = PRISMRIVER_BTN_PS,
+};
+
+int prismriver_usage_target(__u32 usage, unsigned int *target,
+			    __u16 *button)
+{
+	unsigned int n = usage & 0xffff;
+
+	*button = 0;
+
+	if ((usage & 0xffff0000) == GUITAR_USAGE_PAGE_BUTTON) {
+		if (n >= sizeof(guitar_usage_buttons) /
+			 sizeof(guitar_usage_buttons[0]) ||
+		    !guitar_usage_buttons[n])
+			return 0;
+		*target = PRISMRIVER_FIELD_BUTTON;
+		*button = guitar_usage_buttons[n];
+		return 1;
+	}
+
+	switch (usage) {
+	case GUITAR_USAGE_HAT:
+		*target = PRISMRIVER_FIELD_HAT;
+		return 1;
+	case GUITAR_USAGE_Z:
+		*target = PRISMRIVER_FIELD_WHAMMY;
+		return 1;
+	case GUITAR_USAGE_TILT:
+		*target = PRISMRIVER_FIELD_TILT;
+		return 1;
+	}
+
+	return 0;
+}
+
+int prismriver_layout_add(struct prismriver_layout *layout,
+			  unsigned int offset, unsigned int width,
+			  unsigned int target, __u16 button)
+{
+	struct prismriver_field *field;
+	unsigned int end = (offset + width + 7) / 8;
+
+	if (layout->count == PRISMRIVER_FIELDS_MAX || !width || width > 16 ||
+	    end > PRISMRIVER_LAYOUT_MAX_SIZE)
+		return -1;
+
+	field = &layout->fields[layout->count++];
+	field->offset = offset;
+	field->width = width;
+	field->target = target;
+	field->button = button;
+
+	if (end > layout->size)
+		layout->size = end;
+
+	return 0;
+}
+
+static int field_in(const struct prismriver_field *field,
+		    const struct prismriver_layout *layout)
+{
+	const struct prismriver_field *f;
+	unsigned int i;
+
+	for (i = 0; i < layout->count; i++) {
+		f = &layout->fields[i];
+		if (f->offset == field->offset && f->width == field->width &&
+		    f->target == field->target &&
+		    (f->target != PRISMRIVER_FIELD_BUTTON ||
+		     f->button == field->button))
+			return 1;
+	}
+
+	return 0;
+}
+
+int prismriver_layout_equal(const struct prismriver_layout *a,
+			    const struct prismriver_layout *b)
+{
+	unsigned int i;
+
+	if (a->report_id != b->report_id || a->count != b->count ||
+	    a->report_size != b->report_size)
+		return 0;
+
+	for (i = 0; i < a->count; i++)
+		if (!field_in(&a->fields[i], b) || !field_in(&b->fields[i], a))
+			return 0;
+
+	return 1;
+}
+
+/* prismriver_default_layout, without going through the table */
+static int decode_default(const __u8 *rd, unsigned int size,
+			  struct prismriver_frame *frame)
+{
+	if (size != PRISMRIVER_REPORT_SIZE)
+		return -1;
+
+	*frame = (struct prismriver_frame) { 0 };
+
+	if (rd[0] & (1 << 1))
+		frame->buttons |= PRISMRIVER_BTN_GREEN;
+	if (rd[0] & (1 << 2))
+		frame->buttons |= PRISMRIVER_BTN_RED;
+	if (rd[0] & (1 << 3))
+		frame->buttons |= PRISMRIVER_BTN_YELLOW;
+	if (rd[0] & (1 << 0))
+		frame->buttons |= PRISMRIVER_BTN_BLUE;
+	if (rd[0] & (1 << 4))
+		frame->buttons |= PRISMRIVER_BTN_ORANGE;
+	if (rd[1] & (1 << 0))
+		frame->buttons |= PRISMRIVER_BTN_SELECT;
+	if (rd[1] & (1 << 1))
+		frame->buttons |= PRISMRIVER_BTN_START;
+	if (rd[1] & (1 << 4))
+		frame->buttons |= PRISMRIVER_BTN_PS;
+
+	switch (rd[GUITAR_HAT_OFFSET] & 0x0f) {
+	case GUITAR_HAT_UP:
+		frame->strum = PRISMRIVER_STRUM_UP;
+		break;
+	case GUITAR_HAT_DOWN:
+		frame->strum = PRISMRIVER_STRUM_DOWN;
+		break;
+	default:
+		frame->strum = PRISMRIVER_STRUM_NONE;
+		break;
+	}
+
+	frame->whammy = rd[GUITAR_WHAMMY_OFFSET];
+	frame->tilt = (rd[GUITAR_TILT_OFFSET] |
+		       rd[GUITAR_TILT_OFFSET + 1] << 8) & GUITAR_TILT_MASK;
+
+	return 0;
+}
+
+/*
+ * Little endian bit field of up to 16 bits. It spans at most 3 bytes,
+ * which are read unconditionally from the padded copy of the report.
+ */
+static inline unsigned int field_value(const __u8 *rd,
+				       const struct prismriver_field *field)
+{
+	const __u8 *p = rd + field->offset / 8;
+	unsigned int v = p[0] | p[1] << 8 | p[2] << 16;
+
+	return (v >> (field->offset % 8)) & ((1U << field->width) - 1);
+}
+
+int prismriver_decode(const struct prismriver_layout *layout,
+		      const __u8 *rd, unsigned int size,
+		      struct prismriver_frame *frame)
+{
+	__u8 buf[PRISMRIVER_LAYOUT_MAX_SIZE + 2];
+	const struct prismriver_field *field;
+	unsigned int i, v;
+
+	if (layout == &prismriver_default_layout)
+		return decode_default(rd, size, frame);
+
+	if (size != layout->report_size || size < layout->size ||
+	    (layout->report_id && rd[0] != layout->report_id))
+		return -1;
+
+	/* Only the bytes the fields cover, plus room for over-reading */
+	__builtin_memcpy(buf, rd, layout->size);
+	buf[layout->size] = 0;
+	buf[layout->size + 1] = 0;
+	rd = buf;
+
+	*frame = (struct prismriver_frame) { 0 };
+	frame->strum = PRISMRIVER_STRUM_NONE;
+
+	for (i = 0; i < layout->count; i++) {
+		field = &layout->fields[i];
+		v = field_value(rd, field);
+
+		switch (field->target) {
+		case PRISMRIVER_FIELD_BUTTON:
+			if (v)
+				frame->buttons |= field->button;
+			break;
+		case PRISMRIVER_FIELD_HAT:
+			if (v == GUITAR_HAT_UP)
+				frame->strum = PRISMRIVER_STRUM_UP;
+			else if (v == GUITAR_HAT_DOWN)
+				frame->strum = PRISMRIVER_STRUM_DOWN;
+			break;
+		case PRISMRIVER_FIELD_WHAMMY:
+			frame->whammy = v;
+			break;
+		case PRISMRIVER_FIELD_TILT:
+			frame->tilt = v & GUITAR_TILT_MASK;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+unsigned int prismriver_frame_changes(const struct prismriver_frame *last,
+				      const struct prismriver_frame *frame)
+{
+	unsigned int changes = 0;
+
+	if (frame->buttons != last->buttons || frame->strum != last->strum)
+		changes |= PRISMRIVER_CHANGED | PRISMRIVER_CHANGED_EDGE;
+	else if (frame->whammy != last->whammy || frame->tilt != last->tilt)
+		changes |= PRISMRIVER_CHANGED;
+
+	if (frame->strum != PRISMRIVER_STRUM_NONE &&
+	    frame->strum != last->strum)
+		changes |= PRISMRIVER_CHANGED_STRUM;
+
+	return changes;
+}
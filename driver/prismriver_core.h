@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  Report decoder of the prismriver guitar driver.
+ *
+ *  Plain C with no kernel dependencies beyond the uapi types, so that the
+ *  same code runs in the driver and in userspace (libprismriver-core) for
+ *  benchmarking and fuzzing. prismriver_driver.ko links prismriver_core.o
+ *  next to prismriver_main.o, userspace builds it as a library.
+ */
+
+#ifndef _PRISMRIVER_CORE_H
+#define _PRISMRIVER_CORE_H
+
+#include "prismriver.h"
+
+/* Size of the input report sent by the PS3 guitar dongle */
+#define PRISMRIVER_REPORT_SIZE		27
+
+/* What prismriver_frame_changes() found different */
+#define PRISMRIVER_CHANGED		(1 << 0)
+#define PRISMRIVER_CHANGED_EDGE		(1 << 1)	/* buttons or strum */
+#define PRISMRIVER_CHANGED_STRUM	(1 << 2)	/* a new strum */
+
+/*
+ * Report layout: where each guitar control sits in the input report, as
+ * a table of bit fields. The driver builds it from the parsed report
+ * descriptor at probe time; prismriver_default_layout is the layout of
+ * the PS3 guitar dongle, for when that fails.
+ */
+#define PRISMRIVER_FIELDS_MAX		16
+#define PRISMRIVER_LAYOUT_MAX_SIZE	64	/* bytes */
+
+/* prismriver_field.target */
+#define PRISMRIVER_FIELD_BUTTON		0	/* sets @button when non-zero */
+#define PRISMRIVER_FIELD_HAT		1	/* strum bar */
+#define PRISMRIVER_FIELD_WHAMMY		2
+#define PRISMRIVER_FIELD_TILT		3
+
+struct prismriver_field {
+	__u16 offset;		/* in bits, from the start of the report */
+	__u8 width;		/* in bits, at most 16 */
+	__u8 target;
+	__u16 button;		/* PRISMRIVER_BTN_* */
+};
+
+struct prismriver_layout {
+	__u8 report_id;		/* 0 if the device uses none */
+	__u8 count;
+	__u16 size;		/* bytes a report needs to hold all fields */
+	__u16 report_size;	/* bytes of the report, including any ID */
+	struct prismriver_field fields[PRISMRIVER_FIELDS_MAX];
+};
+
+/*
+ * prismriver_decode() decodes this one with hard-coded offsets rather
+ * than by executing the table, which is about twice as fast.
+ */
+extern const struct prismriver_layout prismriver_default_layout;
+
+/*
+ * The decoder target of the control a HID usage (page << 16 | id) stands
+ * for, and the button for PRISMRIVER_FIELD_BUTTON. Returns 0 if the guitar
+ * has no such control.
+ */
+int prismriver_usage_target(__u32 usage, unsigned int *target,
+			    __u16 *button);
+
+/*
+ * Append a field to @layout, @offset counting from the first byte of the
+ * report, including any report ID. Returns 0, or -1 if the field does
+ * not fit the table.
+ */
+int prismriver_layout_add(struct prismriver_layout *layout,
+			  unsigned int offset, unsigned int width,
+			  unsigned int target, __u16 button);
+
+/* Whether @a and @b decode reports the same, in any order of their fields */
+int prismriver_layout_equal(const struct prismriver_layout *a,
+			    const struct prismriver_layout *b);
+
+/*
+ * Decode a raw input report into @frame by executing @layout. Returns 0,
+ * or -1 if the report is not @layout->report_size bytes long or carries
+ * another report ID, in which case @frame is untouched.
+ */
+int prismriver_decode(const struct prismriver_layout *layout,
+		      const __u8 *rd, unsigned int size,
+		      struct prismriver_frame *frame);
+
+/* PRISMRIVER_CHANGED* bits telling how @frame differs from @last */
+unsigned int prismriver_frame_changes(const struct prismriver_frame *last,
+				      const struct prismriver_frame *frame);
+
+#endif /* _PRISMRIVER_CORE_H */
@@ -0,0 +1,3790 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  HID driver for Sony / PS2 / PS3 / PS4 BD devices.
+ *
+ *  Copyright (c) 1999 Andreas Gal
+ *  Copyright (c) 2000-2005 Vojtech Pavlik <vojtech@suse.cz>
+ *  Copyright (c) 2005 Michael Haboustak <mike-@cinci.rr.com> for Concept2, Inc
+ *  Copyright (c) 2008 Jiri Slaby
+ *  Copyright (c) 2012 David Dillow <dave@thedillows.org>
+ *  Copyright (c) 2006-2013 Jiri Kosina
+ *  Copyright (c) 2013 Colin Leitner <colin.leitner@gmail.com>
+ *  Copyright (c) 2014-2016 Frank Praznik <frank.praznik@gmail.com>
+ *  Copyright (c) 2018 Todd Kelner
+ *  Copyright (c) 2020-2021 Pascal Giard <pascal.giard@etsmtl.ca>
+ *  Copyright (c) 2020 Sanjay Govind <sanjay.govind9@gmail.com>
+ *  Copyright (c) 2021 Daniel Nguyen <daniel.nguyen.1@ens.etsmtl.ca>
+ */
+
+/*
+ */
+
+/*
+ * NOTE: in order for the Sony PS3 BD Remote Control to be found by
+ * a Bluetooth host, the key combination Start+Enter has to be kept pressed
+ * for about 7 seconds with the Bluetooth Host Controller in discovering mode.
+ *
+ * There will be no PIN request from the device.
+ */
+
+#include <linux/device.h>
+#include <linux/hid.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/leds.h>
+#include <linux/power_supply.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/idr.h>
+#include <linux/input/mt.h>
+#include <linux/crc32.h>
+#include <linux/usb.h>
+#include <linux/timer.h>
+#include <linux/unaligned.h>
+#include <linux/miscdevice.h>
+#include <linux/hrtimer.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/relay.h>
+#include <linux/timex.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/rcupdate.h>
+
+#include "hid-ids.h"
+#include "prismriver.h"
+#include "prismriver_core.h"
+
+#define GH_GUITAR_CONTROLLER      BIT(14)
+
+#define MAX_LEDS 4
+#define GUITAR_TILT_USAGE 44
+
+
+/*
+ * Bus frame clock. The frame counter returned by the host controller is
+ * 11 bits wide and counts 1 ms frames; a guitar silent for longer than a
+ * wrap makes the extended count ambiguous, so the correlation restarts.
+ */
+#define GUITAR_FRAME_MASK 0x7ff
+#define GUITAR_FRAME_RESYNC_NS (1000 * NSEC_PER_MSEC)
+#define GUITAR_FRAME_TRACK_SHIFT 8
+
+/* Weights of the rolling latency averages, as in TCP's srtt and mdev */
+#define GUITAR_LAT_AVG_SHIFT 3
+#define GUITAR_LAT_DEV_SHIFT 2
+
+/*
+ * Report inter-arrival histogram: bucket 0 counts intervals below 1 us,
+ * bucket n those in [2^(n-1), 2^n) us. The last one takes the rest.
+ */
+#define GUITAR_HIST_BUCKETS 24
+
+#define GUITAR_RECORDER_SIZE 256 /* Must be a power of two */
+
+/*
+ * Relay capture sub-buffers hold a whole number of records, so that the
+ * stream of each CPU is a plain array of struct prismriver_raw_record.
+ */
+#define GUITAR_CAPTURE_SUBBUF_RECORDS 1024
+#define GUITAR_CAPTURE_SUBBUFS 8
+
+/* Largest capture the injector accepts, and largest report it replays */
+#define GUITAR_INJECT_MAX_SIZE (16 << 20)
+#define GUITAR_INJECT_REPORT_MAX 64
+
+#define GUITAR_RING_SIZE PRISMRIVER_RING_SIZE /* Must be a power of two */
+#define GUITAR_READ_BATCH 8
+
+static DEFINE_SPINLOCK(sony_dev_list_lock);
+static LIST_HEAD(sony_device_list);
+static DEFINE_IDA(sony_device_id_allocator);
+
+enum sony_worker {
+	SONY_WORKER_STATE
+};
+
+/*
+ * Chart window of the in-kernel judge, a ring of upcoming notes. Notes in
+ * [tail, head) are still waiting for their strum.
+ */
+struct guitar_judge {
+	struct hrtimer miss_timer;
+	u64 window_ns;
+	u32 head;
+	u32 tail;
+	struct prismriver_chart_note notes[PRISMRIVER_CHART_MAX];
+};
+
+/*
+ * Event channel of a guitar, exposed as /dev/prismriverN. It is reference
+ * counted separately from sony_sc because open files may outlive the
+ * hid_device they were opened on.
+ */
+struct guitar_chan {
+	struct kref ref;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct list_head clients;
+	struct miscdevice misc;
+	char name[16];
+	bool dead;
+	struct sony_sc *sc;	/* NULL once dead */
+	bool busy_poll;
+	struct prismriver_ring *ring;
+	struct guitar_judge judge;
+};
+
+/* One open file of a guitar_chan */
+struct guitar_client {
+	struct list_head node;
+	struct guitar_chan *chan;
+	struct hrtimer flush_timer;
+	u32 tail;
+	u32 mask;
+	u32 pending;
+	u32 coalesce_usecs;
+	u32 coalesce_frames;
+	u64 last_wake_ns;
+	bool ready;
+};
+
+/*
+ * Correlation between the USB frame counter and CLOCK_MONOTONIC. @epoch_ns
+ * is the monotonic time of frame 0 of the extended count, plus the
+ * shortest report handling delay seen so far.
+ */
+struct guitar_frame_clock {
+	u64 frame;
+	u64 last_ns;
+	s64 epoch_ns;
+	u16 raw;
+	bool valid;
+};
+
+/*
+ * Rolling estimates of the driver's own latency: from the report
+ * timestamp to the input_sync() that hands it to evdev, and between
+ * consecutive reports.
+ */
+struct guitar_latency {
+	u64 report_ns;
+	u64 last_report_ns;
+	u64 samples;
+	s64 pipeline_ns;
+	s64 pipeline_dev_ns;
+	s64 interval_ns;
+};
+
+/*
+ * CPU cost of the driver per report, in get_cycles() units: from
+ * raw_event to after the input_sync() in the report callback, so
+ * including hid-input's processing and the evdev delivery.
+ */
+struct guitar_cost {
+	cycles_t start;
+	u64 reports;
+	u64 cycles;
+};
+
+/*
+ * Extra interrupt URBs queued on the guitar's input endpoint next to
+ * usbhid's own, so that a late resubmission does not miss a poll.
+ */
+#define GUITAR_MAX_URBS 4
+
+/*
+ * After a bus error, how long the URB that saw it rests before it is
+ * queued again, as usbhid's own longest retry delay.
+ */
+#define GUITAR_URB_RETRY_MS 100
+
+struct guitar_urbs {
+	struct mutex lock;
+	struct urb *urbs[GUITAR_MAX_URBS];
+	unsigned int count;
+	bool suspended;
+	unsigned long stopped;		/* URBs waiting for @retry */
+	bool halted;
+	struct delayed_work retry;
+};
+
+/*
+ * Keyboard translation, see struct prismriver_keymap. Each layer of a
+ * profile is compiled into the combo that wins in each of the
+ * GUITAR_KEY_STATES states of the inputs, so that a frame costs one
+ * lookup however many combos there are. Profiles are replaced under RCU.
+ * The keyboard state, active layer included, is kept by the report path
+ * under keys->lock, which the repeat timer and a profile change that
+ * releases the keys of the old profile take too.
+ */
+#define GUITAR_KEY_STATES (1 << PRISMRIVER_KEY_INPUTS)
+#define GUITAR_KEYBOARD_SUFFIX " Keyboard"
+
+/* Initial key repeat settings of the keyboard, those of the input core */
+#define GUITAR_REPEAT_DELAY_MS 250
+#define GUITAR_REPEAT_PERIOD_MS 33
+
+struct guitar_layer {
+	u16 keys[PRISMRIVER_KEY_INPUTS];
+	u16 repeat;
+	struct prismriver_combo combos[PRISMRIVER_COMBO_MAX];
+	u8 combo[GUITAR_KEY_STATES];	/* winning combo + 1, 0 for none */
+};
+
+struct guitar_keymap {
+	struct rcu_head rcu;
+	u32 gen;
+	u16 repeat_delay_ms;		/* 0 to keep the keyboard's own */
+	u16 repeat_period_ms;
+	struct guitar_layer layers[PRISMRIVER_LAYERS_MAX];
+};
+
+struct guitar_keys {
+	spinlock_t lock;
+	struct guitar_keymap __rcu *map;
+	u32 gen;			/* of the map the state below is for */
+	u8 layer;
+	u8 combo;
+	u16 held;			/* inputs typing their own key */
+	u16 latched;			/* inputs held since the last switch */
+	u16 down[PRISMRIVER_KEY_INPUTS];	/* key pressed by each held input */
+
+	/*
+	 * Repeat of the last pressed repeating key. The timer is stopped
+	 * while a frame is handled, so that it only runs between frames,
+	 * and stops by itself once @repeat_key is cleared.
+	 */
+	struct hrtimer repeat_timer;
+	u16 repeat_key;			/* 0 when nothing repeats */
+	u8 repeat_input;
+	u64 repeat_period_ns;
+};
+
+/*
+ * Rate caps of the whammy and tilt axes of the joystick device. A change
+ * within @interval_ns of the last one emitted is held back in the axis'
+ * slot, which keeps only the latest value. Once the window is over, the
+ * next report emits it before its sync or, between reports, the flush
+ * timer does. Protected by sc->lock.
+ *
+ * The timer must not emit while hid-input emits a report on the same
+ * device, or its sync would split that report. raw_event marks a report
+ * in flight under @emit_lock, which the timer holds while it emits, and
+ * sony_report() clears the mark once the report is synced. A mark older
+ * than GUITAR_AXES_REPORT_NS is of a report the HID core dropped before
+ * the report callback and is ignored.
+ */
+#define GUITAR_AXES_REPORT_NS	(1 * NSEC_PER_MSEC)
+#define GUITAR_AXES_DEFER_NS	(100 * NSEC_PER_USEC)
+
+enum guitar_axis_id {
+	GUITAR_AXIS_WHAMMY,
+	GUITAR_AXIS_TILT,
+	GUITAR_AXES
+};
+
+struct guitar_axis {
+	struct input_dev *input;
+	unsigned int code;
+	u64 interval_ns;		/* 0 for no cap */
+	u64 last_ns;
+	s32 value;
+	bool pending;
+};
+
+struct guitar_axes {
+	struct hrtimer flush_timer;
+	u64 expires_ns;			/* of the timer, U64_MAX when idle */
+	bool dead;
+	struct guitar_axis axis[GUITAR_AXES];
+
+	spinlock_t emit_lock;
+	bool in_report;
+	u64 report_ns;
+};
+
+/* Report inter-arrival statistics, for spotting lost packets */
+struct guitar_arrival {
+	u64 nominal_ns;
+	u64 gaps;
+	u64 hist[GUITAR_HIST_BUCKETS];
+};
+
+/*
+ * Flight recorder of the last raw reports. It is written from the report
+ * path only, which the HID core serializes, so the writer needs no lock.
+ * Each record is guarded by its own sequence number against readers that
+ * race with the writer: GUITAR_RECORDER_BUSY while it is rewritten,
+ * the report's sequence number once it is complete.
+ */
+#define GUITAR_RECORDER_BUSY U32_MAX
+
+struct guitar_recorder {
+	u32 head;
+	struct prismriver_raw_record recs[GUITAR_RECORDER_SIZE];
+};
+
+/*
+ * Report injector: replays a capture file through hid_input_report() from
+ * an hrtimer, at the offsets it was recorded with. @lateness_ns sums how
+ * late each report was fed in, for judging the replay itself. The timer
+ * is a softirq one, so that replayed reports are handled in the same
+ * context as usbhid's URB completions.
+ */
+struct guitar_injector {
+	struct mutex lock;
+	struct hrtimer timer;
+	void *capture;
+	const u8 *records;
+	u32 count;
+	u32 pos;
+	u16 report_size;
+	bool dead;
+	u64 next_ns;
+	u64 max_late_ns;
+	u64 lateness_ns;
+	u8 report[GUITAR_INJECT_REPORT_MAX];
+};
+
+/*
+ * A capture being written to the inject file. @total is its full length,
+ * known once the header is in, 0 before.
+ */
+struct guitar_inject_upload {
+	struct sony_sc *sc;
+	u8 *buf;
+	size_t len;
+	size_t size;
+	size_t total;
+};
+
+static struct dentry *prismriver_debugfs_root;
+
+struct sony_sc {
+	spinlock_t lock;
+	struct list_head list_node;
+	struct hid_device *hdev;
+	struct input_dev *touchpad;
+	struct input_dev *sensor_dev;
+	struct led_classdev *leds[MAX_LEDS];
+	unsigned long quirks;
+	struct work_struct state_worker;
+	void (*send_output_report)(struct sony_sc *);
+	struct power_supply *battery;
+	struct power_supply_desc battery_desc;
+	int device_id;
+	u8 *output_report_dmabuf;
+
+#ifdef CONFIG_SONY_FF
+	u8 left;
+	u8 right;
+#endif
+
+	u8 mac_address[6];
+	u8 state_worker_initialized;
+	u8 defer_initialization;
+	u8 battery_capacity;
+	int battery_status;
+	u8 led_state[MAX_LEDS];
+	u8 led_delay_on[MAX_LEDS];
+	u8 led_delay_off[MAX_LEDS];
+	u8 led_count;
+
+	/* Guitar */
+	struct usb_device *usbdev;
+	const struct prismriver_layout *layout;
+	struct prismriver_layout parsed_layout;
+	struct prismriver_frame guitar_frame;
+	struct guitar_chan *chan;
+	struct input_dev *keyboard;
+	struct guitar_keys keys;
+	struct guitar_axes axes;
+	struct guitar_frame_clock frame_clock;
+	bool frame_timestamps;
+	struct guitar_latency latency;
+	struct guitar_cost cost;
+	struct guitar_urbs urbs;
+	struct guitar_arrival arrival;
+	struct guitar_recorder *recorder;
+	struct dentry *debugfs;
+	struct mutex capture_lock;
+	struct rchan *capture;
+	struct guitar_injector inject;
+};
+
+static inline void sony_schedule_work(struct sony_sc *sc,
+				      enum sony_worker which)
+{
+	unsigned long flags;
+
+	switch (which) {
+	case SONY_WORKER_STATE:
+		spin_lock_irqsave(&sc->lock, flags);
+		if (!sc->defer_initialization && sc->state_worker_initialized)
+			schedule_work(&sc->state_worker);
+		spin_unlock_irqrestore(&sc->lock, flags);
+		break;
+	}
+}
+
+static int guitar_mapping(struct hid_device *hdev, struct hid_input *hi,
+			  struct hid_field *field, struct hid_usage *usage,
+			  unsigned long **bit, int *max)
+{
+	if ((usage->hid & HID_USAGE_PAGE) == HID_UP_MSVENDOR) {
+		unsigned int abs = usage->hid & HID_USAGE;
+
+		if (abs == GUITAR_TILT_USAGE) {
+			hid_map_usage_clear(hi, usage, bit, max, EV_ABS, ABS_RY);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Build the decoder's field table from the parsed report descriptor, so
+ * that per report the decoder only executes (bit offset, width, target)
+ * entries. Falls back to the dongle's known layout if no input report has
+ * both the frets and the strum bar, and uses it as well when the table is
+ * the same, since the decoder has a faster path for it.
+ */
+static void guitar_build_layout(struct sony_sc *sc)
+{
+	struct hid_report_enum *re = &sc->hdev->report_enum[HID_INPUT_REPORT];
+	struct prismriver_layout *layout = &sc->parsed_layout;
+	unsigned int i, j, n, offset, target, found;
+	struct hid_report *report;
+	struct hid_field *field;
+	u16 button;
+
+	list_for_each_entry(report, &re->report_list, list) {
+		memset(layout, 0, sizeof(*layout));
+		layout->report_id = report->id;
+		layout->report_size = hid_report_len(report);
+		found = 0;
+
+		for (i = 0; i < report->maxfield; i++) {
+			field = report->field[i];
+			if (!(field->flags & HID_MAIN_ITEM_VARIABLE))
+				continue;
+
+			n = min(field->maxusage, field->report_count);
+			for (j = 0; j < n; j++) {
+				if (!prismriver_usage_target(field->usage[j].hid,
+							 &target, &button))
+					continue;
+
+				offset = (report->id ? 8 : 0) +
+					 field->report_offset +
+					 j * field->report_size;
+				if (prismriver_layout_add(layout, offset,
+							  field->report_size,
+							  target, button))
+					goto fallback;
+				found |= BIT(target);
+			}
+		}
+
+		if ((found & BIT(PRISMRIVER_FIELD_BUTTON)) &&
+		    (found & BIT(PRISMRIVER_FIELD_HAT))) {
+			if (prismriver_layout_equal(layout,
+						    &prismriver_default_layout))
+				break;
+			hid_dbg(sc->hdev, "decoding %u fields of report %u\n",
+				layout->count, report->id);
+			sc->layout = layout;
+			return;
+		}
+	}
+
+fallback:
+	hid_dbg(sc->hdev, "using the default report layout\n");
+	sc->layout = &prismriver_default_layout;
+}
+
+static void guitar_chan_free(struct kref *ref)
+{
+	struct guitar_chan *chan = container_of(ref, struct guitar_chan, ref);
+
+	hrtimer_cancel(&chan->judge.miss_timer);
+	vfree(chan->ring);
+	kfree(chan);
+}
+
+/*
+ * Decide whether an analog-only frame may be held back from @client.
+ * Returns false once the frame or time budget of its moderation settings
+ * is used up, in which case the client has to be woken now. Otherwise the
+ * flush timer makes sure the held back frames are delivered on time.
+ */
+static bool guitar_client_coalesce(struct guitar_client *client, u64 now)
+{
+	u64 deadline;
+
+	if (!client->coalesce_usecs && !client->coalesce_frames)
+		return false;
+
+	client->pending++;
+	if (client->coalesce_frames && client->pending >= client->coalesce_frames)
+		return false;
+
+	if (client->coalesce_usecs) {
+		deadline = client->last_wake_ns +
+			   (u64)client->coalesce_usecs * NSEC_PER_USEC;
+		if (now >= deadline)
+			return false;
+
+		if (!hrtimer_is_queued(&client->flush_timer))
+			hrtimer_start(&client->flush_timer, ns_to_ktime(deadline),
+				      HRTIMER_MODE_ABS);
+	}
+
+	return true;
+}
+
+static enum hrtimer_restart guitar_client_flush(struct hrtimer *timer)
+{
+	struct guitar_client *client = container_of(timer, struct guitar_client,
+						    flush_timer);
+	struct guitar_chan *chan = client->chan;
+	unsigned long flags;
+
+	spin_lock_irqsave(&chan->lock, flags);
+	if (client->pending) {
+		client->pending = 0;
+		client->last_wake_ns = ktime_get_ns();
+		client->ready = true;
+	}
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	wake_up_interruptible(&chan->wait);
+
+	return HRTIMER_NORESTART;
+}
+
+static void guitar_chan_publish(struct guitar_chan *chan,
+				struct prismriver_event *ev)
+{
+	struct prismriver_ring *ring = chan->ring;
+	struct guitar_client *client;
+	unsigned long flags;
+	bool wake = false;
+	u32 head;
+
+	spin_lock_irqsave(&chan->lock, flags);
+
+	head = ring->head;
+	ev->seq = head;
+	ring->events[head & (GUITAR_RING_SIZE - 1)] = *ev;
+	smp_store_release(&ring->head, head + 1);
+
+	/* Busy-polling consumers spin on ring->head, nobody to wake */
+	if (chan->busy_poll) {
+		spin_unlock_irqrestore(&chan->lock, flags);
+		return;
+	}
+
+	list_for_each_entry(client, &chan->clients, node) {
+		if (!(client->mask & PRISMRIVER_EV_MASK(ev->type)))
+			continue;
+
+		if (!(ev->flags & PRISMRIVER_EVF_EDGE) &&
+		    guitar_client_coalesce(client, ev->time_ns))
+			continue;
+
+		client->pending = 0;
+		client->last_wake_ns = ev->time_ns;
+		client->ready = true;
+		hrtimer_try_to_cancel(&client->flush_timer);
+		wake = true;
+	}
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	if (wake)
+		wake_up_interruptible(&chan->wait);
+}
+
+#define GUITAR_CHART_MASK (PRISMRIVER_CHART_MAX - 1)
+
+static void guitar_judge_publish(struct guitar_chan *chan, u64 time_ns,
+				 u8 result, u8 frets,
+				 const struct prismriver_chart_note *note,
+				 s64 offset_ns)
+{
+	struct prismriver_event ev = {
+		.time_ns = time_ns,
+		.type = PRISMRIVER_EV_JUDGE,
+		.flags = PRISMRIVER_EVF_EDGE,
+		.judgement = {
+			.result = result,
+			.frets = frets,
+			.expected_frets = note ? note->frets : 0,
+			.offset_ns = clamp_t(s64, offset_ns, S32_MIN, S32_MAX),
+			.id = note ? note->id : PRISMRIVER_JUDGE_NO_NOTE,
+		},
+	};
+
+	guitar_chan_publish(chan, &ev);
+}
+
+/*
+ * Pop the oldest pending note if its hit window ended before @now.
+ * Called with chan->lock held.
+ */
+static bool guitar_judge_pop_missed(struct guitar_judge *judge, u64 now,
+				    struct prismriver_chart_note *missed)
+{
+	struct prismriver_chart_note *note;
+
+	if (judge->tail == judge->head)
+		return false;
+
+	note = &judge->notes[judge->tail & GUITAR_CHART_MASK];
+	if (note->time_ns + judge->window_ns >= now)
+		return false;
+
+	*missed = *note;
+	judge->tail++;
+
+	return true;
+}
+
+/* Called with chan->lock held */
+static void guitar_judge_arm(struct guitar_chan *chan)
+{
+	struct guitar_judge *judge = &chan->judge;
+	struct prismriver_chart_note *note;
+
+	if (chan->dead || judge->tail == judge->head)
+		return;
+
+	note = &judge->notes[judge->tail & GUITAR_CHART_MASK];
+	hrtimer_start(&judge->miss_timer,
+		      ns_to_ktime(note->time_ns + judge->window_ns + 1),
+		      HRTIMER_MODE_ABS);
+}
+
+static void guitar_judge_expire(struct guitar_chan *chan, u64 now)
+{
+	struct guitar_judge *judge = &chan->judge;
+	struct prismriver_chart_note missed;
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&chan->lock, flags);
+		if (!guitar_judge_pop_missed(judge, now, &missed)) {
+			spin_unlock_irqrestore(&chan->lock, flags);
+			break;
+		}
+		spin_unlock_irqrestore(&chan->lock, flags);
+
+		guitar_judge_publish(chan, missed.time_ns + judge->window_ns,
+				     PRISMRIVER_JUDGE_MISS, 0, &missed, 0);
+	}
+}
+
+static enum hrtimer_restart guitar_judge_miss_timer(struct hrtimer *timer)
+{
+	struct guitar_judge *judge = container_of(timer, struct guitar_judge,
+						  miss_timer);
+	struct guitar_chan *chan = container_of(judge, struct guitar_chan, judge);
+	unsigned long flags;
+
+	guitar_judge_expire(chan, ktime_get_ns());
+
+	spin_lock_irqsave(&chan->lock, flags);
+	guitar_judge_arm(chan);
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Judge a strum against the chart window. Notes whose window ended before
+ * the strum are misses; the strum then either hits the oldest pending
+ * note, if it is within the window and the frets match, or overstrums.
+ */
+static void guitar_judge_strum(struct guitar_chan *chan,
+			       const struct prismriver_event *note_ev)
+{
+	struct guitar_judge *judge = &chan->judge;
+	struct prismriver_chart_note *pending, target;
+	u64 now = note_ev->time_ns;
+	u8 frets = note_ev->note.frets;
+	unsigned long flags;
+	bool in_window = false;
+	u8 result;
+
+	if (!READ_ONCE(judge->window_ns))
+		return;
+
+	guitar_judge_expire(chan, now);
+
+	spin_lock_irqsave(&chan->lock, flags);
+	if (judge->tail != judge->head) {
+		pending = &judge->notes[judge->tail & GUITAR_CHART_MASK];
+		in_window = pending->time_ns <= now + judge->window_ns;
+		target = *pending;
+	}
+
+	result = PRISMRIVER_JUDGE_OVERSTRUM;
+	if (in_window && target.frets == frets) {
+		result = PRISMRIVER_JUDGE_HIT;
+		judge->tail++;
+		hrtimer_try_to_cancel(&judge->miss_timer);
+		guitar_judge_arm(chan);
+	}
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	guitar_judge_publish(chan, now, result, frets,
+			     in_window ? &target : NULL,
+			     in_window ? (s64)(now - target.time_ns) : 0);
+}
+
+static int guitar_judge_reset(struct guitar_chan *chan, u32 window_us)
+{
+	struct guitar_judge *judge = &chan->judge;
+	unsigned long flags;
+
+	hrtimer_cancel(&judge->miss_timer);
+
+	spin_lock_irqsave(&chan->lock, flags);
+	judge->head = judge->tail = 0;
+	WRITE_ONCE(judge->window_ns, (u64)window_us * NSEC_PER_USEC);
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	return 0;
+}
+
+static int guitar_judge_append(struct guitar_chan *chan,
+			       const struct prismriver_chart *chart)
+{
+	struct guitar_judge *judge = &chan->judge;
+	u64 last = 0;
+	unsigned long flags;
+	bool idle;
+	u32 i;
+
+	if (chart->count > PRISMRIVER_CHART_BATCH)
+		return -EINVAL;
+
+	for (i = 0; i < chart->count; i++) {
+		if (chart->notes[i].time_ns < last)
+			return -EINVAL;
+		last = chart->notes[i].time_ns;
+	}
+
+	spin_lock_irqsave(&chan->lock, flags);
+
+	if (!judge->window_ns) {
+		spin_unlock_irqrestore(&chan->lock, flags);
+		return -EPERM;
+	}
+
+	if (judge->head - judge->tail + chart->count > PRISMRIVER_CHART_MAX) {
+		spin_unlock_irqrestore(&chan->lock, flags);
+		return -ENOSPC;
+	}
+
+	if (chart->count && judge->head != judge->tail &&
+	    judge->notes[(judge->head - 1) & GUITAR_CHART_MASK].time_ns >
+	    chart->notes[0].time_ns) {
+		spin_unlock_irqrestore(&chan->lock, flags);
+		return -EINVAL;
+	}
+
+	idle = judge->head == judge->tail;
+	for (i = 0; i < chart->count; i++)
+		judge->notes[judge->head++ & GUITAR_CHART_MASK] = chart->notes[i];
+
+	if (idle)
+		guitar_judge_arm(chan);
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	return 0;
+}
+
+static int guitar_chan_open(struct inode *inode, struct file *file)
+{
+	struct guitar_chan *chan = container_of(file->private_data,
+						struct guitar_chan, misc);
+	struct guitar_client *client;
+	unsigned long flags;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	client->chan = chan;
+	client->mask = PRISMRIVER_EV_MASK_ALL;
+	hrtimer_setup(&client->flush_timer, guitar_client_flush,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+	spin_lock_irqsave(&chan->lock, flags);
+	if (chan->dead) {
+		spin_unlock_irqrestore(&chan->lock, flags);
+		kfree(client);
+		return -ENODEV;
+	}
+	client->tail = chan->ring->head;
+	list_add_tail(&client->node, &chan->clients);
+	kref_get(&chan->ref);
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	file->private_data = client;
+
+	return stream_open(inode, file);
+}
+
+static int guitar_chan_release(struct inode *inode, struct file *file)
+{
+	struct guitar_client *client = file->private_data;
+	struct guitar_chan *chan = client->chan;
+	unsigned long flags;
+
+	spin_lock_irqsave(&chan->lock, flags);
+	list_del(&client->node);
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	hrtimer_cancel(&client->flush_timer);
+	kfree(client);
+	kref_put(&chan->ref, guitar_chan_free);
+
+	return 0;
+}
+
+static ssize_t guitar_chan_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct guitar_client *client = file->private_data;
+	struct guitar_chan *chan = client->chan;
+	struct prismriver_ring *ring = chan->ring;
+	struct prismriver_event batch[GUITAR_READ_BATCH];
+	struct prismriver_event *ev;
+	unsigned long flags;
+	size_t copied = 0;
+	u32 avail, max, n;
+	int ret;
+
+	if (count < sizeof(batch[0]))
+		return -EINVAL;
+
+	for (;;) {
+		if (!(file->f_flags & O_NONBLOCK)) {
+			ret = wait_event_interruptible(chan->wait,
+					READ_ONCE(client->ready) ||
+					READ_ONCE(chan->dead));
+			if (ret)
+				return ret;
+		}
+
+		while (copied + sizeof(batch[0]) <= count) {
+			spin_lock_irqsave(&chan->lock, flags);
+
+			if (chan->dead) {
+				spin_unlock_irqrestore(&chan->lock, flags);
+				return copied ? copied : -ENODEV;
+			}
+
+			/* A consumer that fell behind loses the oldest events */
+			avail = ring->head - client->tail;
+			if (avail > GUITAR_RING_SIZE) {
+				client->tail = ring->head - GUITAR_RING_SIZE;
+				avail = GUITAR_RING_SIZE;
+			}
+
+			max = min_t(u32, GUITAR_READ_BATCH,
+				    (count - copied) / sizeof(batch[0]));
+			for (n = 0; avail && n < max; avail--, client->tail++) {
+				ev = &ring->events[client->tail &
+						   (GUITAR_RING_SIZE - 1)];
+				if (client->mask & PRISMRIVER_EV_MASK(ev->type))
+					batch[n++] = *ev;
+			}
+			if (client->tail == ring->head)
+				client->ready = false;
+
+			spin_unlock_irqrestore(&chan->lock, flags);
+
+			if (!n)
+				break;
+
+			if (copy_to_user(buf + copied, batch, n * sizeof(batch[0])))
+				return -EFAULT;
+			copied += n * sizeof(batch[0]);
+		}
+
+		if (copied)
+			return copied;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+	}
+}
+
+static __poll_t guitar_chan_poll(struct file *file, poll_table *wait)
+{
+	struct guitar_client *client = file->private_data;
+	struct guitar_chan *chan = client->chan;
+
+	poll_wait(file, &chan->wait, wait);
+
+	if (READ_ONCE(chan->dead))
+		return EPOLLHUP | EPOLLERR;
+
+	return READ_ONCE(client->ready) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int guitar_chan_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct guitar_client *client = file->private_data;
+
+	/* The ring is written by the driver only */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, client->chan->ring, vma->vm_pgoff);
+}
+
+static bool guitar_key_valid(unsigned int key)
+{
+	return key >= KEY_ESC && key <= PRISMRIVER_KEY_MAX;
+}
+
+static int guitar_layer_compile(struct guitar_layer *layer,
+				const struct prismriver_layer *pl,
+				unsigned int layer_count)
+{
+	const struct prismriver_combo *combo;
+	unsigned int i, j, state, best, inputs;
+
+	if (pl->combo_count > PRISMRIVER_COMBO_MAX ||
+	    pl->repeat >= GUITAR_KEY_STATES)
+		return -EINVAL;
+
+	for (i = 0; i < PRISMRIVER_KEY_INPUTS; i++)
+		if (pl->keys[i] && !guitar_key_valid(pl->keys[i]))
+			return -EINVAL;
+
+	for (i = 0; i < pl->combo_count; i++) {
+		combo = &pl->combos[i];
+		if (!combo->inputs || combo->inputs >= GUITAR_KEY_STATES)
+			return -EINVAL;
+
+		if (combo->layer) {
+			if (combo->layer > layer_count || combo->count)
+				return -EINVAL;
+			continue;
+		}
+
+		if (!combo->count || combo->count > PRISMRIVER_COMBO_KEYS)
+			return -EINVAL;
+
+		for (j = 0; j < combo->count; j++)
+			if (!guitar_key_valid(combo->keys[j]))
+				return -EINVAL;
+	}
+
+	memcpy(layer->keys, pl->keys, sizeof(layer->keys));
+	layer->repeat = pl->repeat;
+	memcpy(layer->combos, pl->combos, sizeof(layer->combos));
+
+	for (state = 0; state < GUITAR_KEY_STATES; state++) {
+		best = 0;
+		for (i = 0; i < pl->combo_count; i++) {
+			inputs = pl->combos[i].inputs;
+			if ((state & inputs) != inputs)
+				continue;
+			if (!best || hweight16(inputs) >
+				     hweight16(pl->combos[best - 1].inputs))
+				best = i + 1;
+		}
+		layer->combo[state] = best;
+	}
+
+	return 0;
+}
+
+static struct guitar_keymap *guitar_keymap_compile(const struct prismriver_keymap *km)
+{
+	struct guitar_keymap *map;
+	unsigned int i;
+	int ret;
+
+	if (!km->layer_count || km->layer_count > PRISMRIVER_LAYERS_MAX)
+		return ERR_PTR(-EINVAL);
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+
+	map->repeat_delay_ms = km->repeat_delay_ms;
+	map->repeat_period_ms = km->repeat_period_ms;
+
+	for (i = 0; i < km->layer_count; i++) {
+		ret = guitar_layer_compile(&map->layers[i], &km->layers[i],
+					   km->layer_count);
+		if (ret) {
+			kfree(map);
+			return ERR_PTR(ret);
+		}
+	}
+
+	return map;
+}
+
+static void guitar_axes_set(struct sony_sc *sc, unsigned int whammy_hz,
+			    unsigned int tilt_hz)
+{
+	struct guitar_axes *axes = &sc->axes;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	if (!axes->dead) {
+		axes->axis[GUITAR_AXIS_WHAMMY].interval_ns =
+			whammy_hz ? NSEC_PER_SEC / whammy_hz : 0;
+		axes->axis[GUITAR_AXIS_TILT].interval_ns =
+			tilt_hz ? NSEC_PER_SEC / tilt_hz : 0;
+	}
+	spin_unlock_irqrestore(&sc->lock, flags);
+}
+
+/*
+ * Release every key the keyboard holds and stop the repeat, so that
+ * nothing of the old profile outlives it. The next frame starts over in
+ * layer 0 of the new one, see guitar_keys_frame().
+ */
+static void guitar_keys_release(struct sony_sc *sc)
+{
+	struct guitar_keys *keys = &sc->keys;
+	unsigned long flags, held;
+	unsigned int i;
+
+	spin_lock_irqsave(&keys->lock, flags);
+
+	held = keys->held;
+	for_each_set_bit(i, &held, PRISMRIVER_KEY_INPUTS)
+		if (keys->down[i])
+			input_report_key(sc->keyboard, keys->down[i], 0);
+	input_sync(sc->keyboard);
+
+	keys->held = 0;
+	keys->repeat_key = 0;
+	hrtimer_try_to_cancel(&keys->repeat_timer);
+
+	spin_unlock_irqrestore(&keys->lock, flags);
+}
+
+static int guitar_keys_set(struct guitar_chan *chan,
+			   const struct prismriver_keymap *km)
+{
+	struct guitar_keymap *map, *old = NULL;
+	unsigned long flags;
+	int ret = 0;
+
+	map = guitar_keymap_compile(km);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	spin_lock_irqsave(&chan->lock, flags);
+	if (chan->dead) {
+		ret = -ENODEV;
+	} else {
+		/* Readers may look at gen as soon as the map is published */
+		old = rcu_dereference_protected(chan->sc->keys.map,
+						lockdep_is_held(&chan->lock));
+		map->gen = old->gen + 1;
+		rcu_assign_pointer(chan->sc->keys.map, map);
+		guitar_keys_release(chan->sc);
+
+		/* As EVIOCSREP would, so that readers of the settings see them */
+		if (map->repeat_delay_ms)
+			input_event(chan->sc->keyboard, EV_REP, REP_DELAY,
+				    map->repeat_delay_ms);
+		if (map->repeat_period_ms)
+			input_event(chan->sc->keyboard, EV_REP, REP_PERIOD,
+				    map->repeat_period_ms);
+
+		guitar_axes_set(chan->sc, km->whammy_rate_hz, km->tilt_rate_hz);
+	}
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	if (ret) {
+		kfree(map);
+		return ret;
+	}
+	kfree_rcu(old, rcu);
+
+	return 0;
+}
+
+static long guitar_chan_ioctl(struct file *file, unsigned int cmd,
+			      unsigned long arg)
+{
+	struct guitar_client *client = file->private_data;
+	struct guitar_chan *chan = client->chan;
+	void __user *argp = (void __user *)arg;
+	struct prismriver_chart *chart;
+	struct prismriver_keymap *km;
+	struct prismriver_coalesce coal;
+	unsigned long flags;
+	u32 mask, window;
+	int ret;
+
+	switch (cmd) {
+	case PRISMRIVER_IOC_GET_COALESCE:
+		spin_lock_irqsave(&chan->lock, flags);
+		coal.usecs = client->coalesce_usecs;
+		coal.frames = client->coalesce_frames;
+		spin_unlock_irqrestore(&chan->lock, flags);
+
+		return copy_to_user(argp, &coal, sizeof(coal)) ? -EFAULT : 0;
+
+	case PRISMRIVER_IOC_SET_COALESCE:
+		if (copy_from_user(&coal, argp, sizeof(coal)))
+			return -EFAULT;
+
+		spin_lock_irqsave(&chan->lock, flags);
+		client->coalesce_usecs = coal.usecs;
+		client->coalesce_frames = coal.frames;
+		spin_unlock_irqrestore(&chan->lock, flags);
+
+		return 0;
+
+	case PRISMRIVER_IOC_GET_MASK:
+		return put_user(READ_ONCE(client->mask), (u32 __user *)argp);
+
+	case PRISMRIVER_IOC_SET_MASK:
+		if (get_user(mask, (u32 __user *)argp))
+			return -EFAULT;
+
+		WRITE_ONCE(client->mask, mask);
+
+		return 0;
+
+	case PRISMRIVER_IOC_CHART_RESET:
+		if (get_user(window, (u32 __user *)argp))
+			return -EFAULT;
+
+		return guitar_judge_reset(chan, window);
+
+	case PRISMRIVER_IOC_CHART_APPEND:
+		chart = memdup_user(argp, sizeof(*chart));
+		if (IS_ERR(chart))
+			return PTR_ERR(chart);
+
+		ret = guitar_judge_append(chan, chart);
+		kfree(chart);
+
+		return ret;
+
+	case PRISMRIVER_IOC_SET_KEYMAP:
+		km = memdup_user(argp, sizeof(*km));
+		if (IS_ERR(km))
+			return PTR_ERR(km);
+
+		ret = guitar_keys_set(chan, km);
+		kfree(km);
+
+		return ret;
+	}
+
+	return -ENOTTY;
+}
+
+static const struct file_operations guitar_chan_fops = {
+	.owner          = THIS_MODULE,
+	.open           = guitar_chan_open,
+	.release        = guitar_chan_release,
+	.read           = guitar_chan_read,
+	.poll           = guitar_chan_poll,
+	.mmap           = guitar_chan_mmap,
+	.unlocked_ioctl = guitar_chan_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
+};
+
+static int guitar_chan_create(struct sony_sc *sc)
+{
+	struct guitar_chan *chan;
+	int ret;
+
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan)
+		return -ENOMEM;
+
+	chan->ring = vmalloc_user(PRISMRIVER_RING_MMAP_SIZE);
+	if (!chan->ring) {
+		kfree(chan);
+		return -ENOMEM;
+	}
+	chan->ring->size = GUITAR_RING_SIZE;
+
+	kref_init(&chan->ref);
+	spin_lock_init(&chan->lock);
+	init_waitqueue_head(&chan->wait);
+	INIT_LIST_HEAD(&chan->clients);
+	hrtimer_setup(&chan->judge.miss_timer, guitar_judge_miss_timer,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+	snprintf(chan->name, sizeof(chan->name), "prismriver%d", sc->device_id);
+	chan->misc.minor = MISC_DYNAMIC_MINOR;
+	chan->misc.name = chan->name;
+	chan->misc.fops = &guitar_chan_fops;
+	chan->misc.parent = &sc->hdev->dev;
+	chan->sc = sc;
+
+	ret = misc_register(&chan->misc);
+	if (ret) {
+		vfree(chan->ring);
+		kfree(chan);
+		return ret;
+	}
+
+	/* Reports already flow, see guitar_parse_report() */
+	WRITE_ONCE(sc->chan, chan);
+
+	return 0;
+}
+
+static void guitar_chan_destroy(struct sony_sc *sc)
+{
+	struct guitar_chan *chan = sc->chan;
+	unsigned long flags;
+
+	if (!chan)
+		return;
+
+	spin_lock_irqsave(&chan->lock, flags);
+	chan->dead = true;
+	chan->sc = NULL;
+	spin_unlock_irqrestore(&chan->lock, flags);
+	wake_up_interruptible(&chan->wait);
+	hrtimer_cancel(&chan->judge.miss_timer);
+
+	misc_deregister(&chan->misc);
+	WRITE_ONCE(sc->chan, NULL);
+	kref_put(&chan->ref, guitar_chan_free);
+}
+
+/*
+ * Keyboard input device of a guitar, which types the keys of its profile.
+ * It advertises every key a profile can use, with the default profile
+ * being empty. Presetting the repeat settings leaves repeat to the driver,
+ * see guitar_keys_repeat(): the input core would repeat every held key.
+ */
+static int guitar_keyboard_create(struct sony_sc *sc)
+{
+	struct hid_device *hdev = sc->hdev;
+	struct guitar_keymap *map;
+	struct input_dev *input;
+	size_t name_sz;
+	char *name;
+	int key, ret;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	RCU_INIT_POINTER(sc->keys.map, map);
+
+	input = devm_input_allocate_device(&hdev->dev);
+	if (!input)
+		return -ENOMEM;
+
+	name_sz = strlen(hdev->name) + sizeof(GUITAR_KEYBOARD_SUFFIX);
+	name = devm_kzalloc(&hdev->dev, name_sz, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	snprintf(name, name_sz, "%s" GUITAR_KEYBOARD_SUFFIX, hdev->name);
+
+	input->name = name;
+	input->phys = hdev->phys;
+	input->uniq = hdev->uniq;
+	input->id.bustype = hdev->bus;
+	input->id.vendor = hdev->vendor;
+	input->id.product = hdev->product;
+	input->id.version = hdev->version;
+	input->dev.parent = &hdev->dev;
+
+	__set_bit(EV_KEY, input->evbit);
+	__set_bit(EV_REP, input->evbit);
+	input->rep[REP_DELAY] = GUITAR_REPEAT_DELAY_MS;
+	input->rep[REP_PERIOD] = GUITAR_REPEAT_PERIOD_MS;
+	for (key = KEY_ESC; key <= PRISMRIVER_KEY_MAX; key++)
+		__set_bit(key, input->keybit);
+
+	ret = input_register_device(input);
+	if (ret)
+		return ret;
+
+	sc->keyboard = input;
+
+	return 0;
+}
+
+/* Once neither reports nor the event channel can reach the profile */
+static void guitar_keyboard_free(struct sony_sc *sc)
+{
+	hrtimer_cancel(&sc->keys.repeat_timer);
+	kfree(rcu_dereference_protected(sc->keys.map, true));
+	RCU_INIT_POINTER(sc->keys.map, NULL);
+}
+
+/*
+ * Turn the frame carrying a strum into a note event, so that consumers
+ * do not have to track the fret state themselves.
+ */
+static void guitar_publish_note(struct guitar_chan *chan,
+				const struct prismriver_event *frame_ev)
+{
+	const struct prismriver_frame *frame = &frame_ev->frame;
+	struct prismriver_event ev = {
+		.time_ns = frame_ev->time_ns,
+		.type = PRISMRIVER_EV_NOTE,
+		.flags = PRISMRIVER_EVF_EDGE,
+		.note = {
+			.frets = frame->buttons & PRISMRIVER_FRET_MASK,
+			.direction = frame->strum,
+			.whammy = frame->whammy,
+			.tilt = frame->tilt,
+		},
+	};
+
+	guitar_chan_publish(chan, &ev);
+	guitar_judge_strum(chan, &ev);
+}
+
+/*
+ * Timestamp a report with the start of the bus frame it was delivered in
+ * rather than with the time it is handled at. The frame boundaries are
+ * found by tracking the smallest offset between the handling time and the
+ * frame counter: it follows drift down immediately and up slowly, so
+ * softirq and interrupt latency only lengthen the offsets that are
+ * ignored. A report handled in a later frame than the one it was
+ * delivered in is still stamped with the later frame.
+ *
+ * These timestamps are only as fine as the frame counter, 1 ms, which is
+ * coarser than ktime: they trade resolution for freedom from handling
+ * jitter. Nothing finer is available to a HID driver. usbhid does not
+ * hand over its URB, urb->start_frame is only filled in for isochronous
+ * transfers, and host controllers report the frame number, not the
+ * microframe, even at high speed.
+ */
+static u64 guitar_frame_time(struct sony_sc *sc, u64 now)
+{
+	struct guitar_frame_clock *clock = &sc->frame_clock;
+	unsigned long flags;
+	s64 offset;
+	u64 ts;
+	int raw;
+
+	raw = usb_get_current_frame_number(sc->usbdev);
+	if (raw < 0)
+		return now;
+
+	spin_lock_irqsave(&sc->lock, flags);
+
+	if (!clock->valid || now - clock->last_ns > GUITAR_FRAME_RESYNC_NS) {
+		clock->frame = 0;
+		clock->epoch_ns = now;
+		clock->valid = true;
+	} else {
+		clock->frame += (raw - clock->raw) & GUITAR_FRAME_MASK;
+	}
+	clock->raw = raw;
+	clock->last_ns = now;
+
+	offset = now - clock->frame * NSEC_PER_MSEC;
+	if (offset < clock->epoch_ns)
+		clock->epoch_ns = offset;
+	else
+		clock->epoch_ns += (offset - clock->epoch_ns) >>
+				   GUITAR_FRAME_TRACK_SHIFT;
+
+	ts = clock->epoch_ns + clock->frame * NSEC_PER_MSEC;
+
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	return ts;
+}
+
+static u64 guitar_report_time(struct sony_sc *sc)
+{
+	u64 now = ktime_get_ns();
+
+	if (READ_ONCE(sc->frame_timestamps) && sc->usbdev)
+		return guitar_frame_time(sc, now);
+
+	return now;
+}
+
+/* Called with sc->lock held */
+static void guitar_update_arrival(struct sony_sc *sc, u64 interval)
+{
+	struct guitar_arrival *arr = &sc->arrival;
+	u64 nominal = arr->nominal_ns ? arr->nominal_ns : sc->latency.interval_ns;
+
+	arr->hist[min_t(u32, fls64(div_u64(interval, NSEC_PER_USEC)),
+			GUITAR_HIST_BUCKETS - 1)]++;
+
+	if (nominal && interval > 2 * nominal)
+		arr->gaps++;
+}
+
+static void guitar_update_interval(struct sony_sc *sc, u64 now)
+{
+	struct guitar_latency *lat = &sc->latency;
+	unsigned long flags;
+	s64 interval;
+
+	spin_lock_irqsave(&sc->lock, flags);
+
+	interval = now - lat->last_report_ns;
+	if (lat->last_report_ns && interval > 0)
+		guitar_update_arrival(sc, interval);
+	if (lat->last_report_ns && interval > 0 &&
+	    interval < GUITAR_FRAME_RESYNC_NS) {
+		if (lat->interval_ns)
+			lat->interval_ns += (interval - lat->interval_ns) >>
+					    GUITAR_LAT_AVG_SHIFT;
+		else
+			lat->interval_ns = interval;
+	}
+	lat->last_report_ns = now;
+	lat->report_ns = now;
+
+	spin_unlock_irqrestore(&sc->lock, flags);
+}
+
+/*
+ * Called from sony_report() right after it synced the input devices of
+ * the report, which closes the driver's part of the pipeline.
+ */
+static void guitar_update_pipeline(struct sony_sc *sc)
+{
+	struct guitar_latency *lat = &sc->latency;
+	u64 now = ktime_get_ns();
+	unsigned long flags;
+	s64 sample, err;
+
+	spin_lock_irqsave(&sc->lock, flags);
+
+	if (!lat->report_ns) {
+		spin_unlock_irqrestore(&sc->lock, flags);
+		return;
+	}
+
+	sample = now - lat->report_ns;
+	lat->report_ns = 0;
+
+	if (!lat->samples++) {
+		lat->pipeline_ns = sample;
+		lat->pipeline_dev_ns = 0;
+	} else {
+		err = sample - lat->pipeline_ns;
+		lat->pipeline_ns += err >> GUITAR_LAT_AVG_SHIFT;
+		lat->pipeline_dev_ns += (abs(err) - lat->pipeline_dev_ns) >>
+					GUITAR_LAT_DEV_SHIFT;
+	}
+
+	spin_unlock_irqrestore(&sc->lock, flags);
+}
+
+static u32 guitar_record(struct guitar_recorder *rec, u8 *rd, int size,
+			 u64 now)
+{
+	u32 head = rec->head;
+	struct prismriver_raw_record *r = &rec->recs[head & (GUITAR_RECORDER_SIZE - 1)];
+
+	WRITE_ONCE(r->seq, GUITAR_RECORDER_BUSY);
+	smp_wmb();
+
+	r->time_ns = now;
+	r->size = size;
+	memcpy(r->data, rd, min_t(int, size, PRISMRIVER_RAW_MAX));
+
+	smp_wmb();
+	WRITE_ONCE(r->seq, head);
+	smp_store_release(&rec->head, head + 1);
+
+	return head;
+}
+
+/*
+ * Stream a report into the relay capture channel, if one is open. The
+ * record lands in the sub-buffer of the current CPU.
+ */
+static void guitar_capture(struct sony_sc *sc, u8 *rd, int size, u64 now,
+			   u32 seq)
+{
+	struct prismriver_raw_record r = {
+		.time_ns = now,
+		.seq = seq,
+		.size = size,
+	};
+	unsigned long flags;
+
+	memcpy(r.data, rd, min_t(int, size, PRISMRIVER_RAW_MAX));
+
+	spin_lock_irqsave(&sc->lock, flags);
+	if (sc->capture)
+		__relay_write(sc->capture, &r, sizeof(r));
+	spin_unlock_irqrestore(&sc->lock, flags);
+}
+
+static unsigned int guitar_key_inputs(const struct prismriver_frame *frame)
+{
+	unsigned int inputs = frame->buttons & 0xff;
+
+	if (frame->strum == PRISMRIVER_STRUM_UP)
+		inputs |= PRISMRIVER_KEY_STRUM_UP;
+	else if (frame->strum == PRISMRIVER_STRUM_DOWN)
+		inputs |= PRISMRIVER_KEY_STRUM_DOWN;
+
+	return inputs;
+}
+
+static void guitar_keys_tap(struct input_dev *input,
+			    const struct prismriver_combo *combo)
+{
+	int i;
+
+	for (i = 0; i < combo->count; i++)
+		input_report_key(input, combo->keys[i], 1);
+	input_sync(input);
+
+	for (i = combo->count - 1; i >= 0; i--)
+		input_report_key(input, combo->keys[i], 0);
+}
+
+/*
+ * Start over in @layer: release every key, and type nothing for the
+ * inputs held now until they are released.
+ */
+static void guitar_keys_switch(struct guitar_keys *keys, struct input_dev *input,
+			       const struct guitar_keymap *map,
+			       unsigned int layer, unsigned int inputs)
+{
+	unsigned long held;
+	unsigned int i;
+
+	held = keys->held;
+	for_each_set_bit(i, &held, PRISMRIVER_KEY_INPUTS)
+		if (keys->down[i])
+			input_report_key(input, keys->down[i], 0);
+
+	keys->held = 0;
+	keys->repeat_key = 0;
+	keys->latched = inputs;
+	keys->layer = layer;
+	keys->combo = map->layers[layer].combo[inputs];
+}
+
+/* Type the keys of a frame in which a fret, button or the strum changed */
+static void guitar_keys_frame(struct sony_sc *sc,
+			      const struct prismriver_frame *frame)
+{
+	struct guitar_keys *keys = &sc->keys;
+	struct input_dev *input = sc->keyboard;
+	const struct prismriver_combo *combo = NULL;
+	const struct guitar_keymap *map;
+	const struct guitar_layer *layer;
+	unsigned int inputs, held, changed, i;
+	ktime_t repeat_at = 0;
+	unsigned long flags;
+	bool repeat;
+	u8 c;
+
+	if (!input)
+		return;
+
+	inputs = guitar_key_inputs(frame);
+
+	/* Outside keys->lock, which the timer takes */
+	if (READ_ONCE(keys->repeat_key)) {
+		repeat_at = hrtimer_get_expires(&keys->repeat_timer);
+		hrtimer_cancel(&keys->repeat_timer);
+	}
+
+	spin_lock_irqsave(&keys->lock, flags);
+	rcu_read_lock();
+	map = rcu_dereference(keys->map);
+
+	if (map->gen != keys->gen) {
+		guitar_keys_switch(keys, input, map, 0, inputs);
+		keys->gen = map->gen;
+	}
+
+	layer = &map->layers[keys->layer];
+	c = layer->combo[inputs];
+	if (c && c != keys->combo && layer->combos[c - 1].layer) {
+		guitar_keys_switch(keys, input, map,
+				   layer->combos[c - 1].layer - 1, inputs);
+		layer = &map->layers[keys->layer];
+		c = keys->combo;
+	}
+	if (c)
+		combo = &layer->combos[c - 1];
+
+	keys->latched &= inputs;
+	held = inputs & ~keys->latched;
+	if (combo)
+		held &= ~combo->inputs;
+
+	for (changed = held ^ keys->held; changed; changed &= changed - 1) {
+		i = __ffs(changed);
+		if (held & BIT(i)) {
+			keys->down[i] = layer->keys[i];
+			if (!keys->down[i])
+				continue;
+			input_report_key(input, keys->down[i], 1);
+
+			if ((layer->repeat & BIT(i)) && input->rep[REP_PERIOD]) {
+				keys->repeat_key = keys->down[i];
+				keys->repeat_input = i;
+				keys->repeat_period_ns =
+					(u64)input->rep[REP_PERIOD] * NSEC_PER_MSEC;
+				repeat_at = ktime_add_ns(ktime_get(),
+					(u64)input->rep[REP_DELAY] * NSEC_PER_MSEC);
+			}
+		} else if (keys->down[i]) {
+			input_report_key(input, keys->down[i], 0);
+			if (keys->repeat_key && keys->repeat_input == i)
+				keys->repeat_key = 0;
+		}
+	}
+	keys->held = held;
+
+	if (c != keys->combo) {
+		keys->combo = c;
+		if (combo && !combo->layer)
+			guitar_keys_tap(input, combo);
+	}
+	rcu_read_unlock();
+
+	input_sync(input);
+
+	repeat = keys->repeat_key;
+	spin_unlock_irqrestore(&keys->lock, flags);
+
+	if (repeat)
+		hrtimer_start(&keys->repeat_timer, repeat_at, HRTIMER_MODE_ABS);
+}
+
+static enum hrtimer_restart guitar_keys_repeat(struct hrtimer *timer)
+{
+	struct guitar_keys *keys = container_of(timer, struct guitar_keys,
+						repeat_timer);
+	struct sony_sc *sc = container_of(keys, struct sony_sc, keys);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+
+	spin_lock_irqsave(&keys->lock, flags);
+	if (keys->repeat_key) {
+		input_event(sc->keyboard, EV_KEY, keys->repeat_key, 2);
+		input_sync(sc->keyboard);
+
+		hrtimer_forward_now(timer, ns_to_ktime(keys->repeat_period_ns));
+		ret = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(&keys->lock, flags);
+
+	return ret;
+}
+
+static void guitar_parse_report(struct sony_sc *sc, u8 *rd, int size, u64 now)
+{
+	struct prismriver_event ev = {
+		.time_ns = now,
+		.type = PRISMRIVER_EV_FRAME,
+	};
+	struct prismriver_frame *frame = &ev.frame;
+	struct prismriver_frame *last = &sc->guitar_frame;
+	struct guitar_chan *chan;
+	unsigned int changes;
+
+	if (prismriver_decode(sc->layout, rd, size, frame))
+		return;
+
+	guitar_update_interval(sc, now);
+
+	changes = prismriver_frame_changes(last, frame);
+	if (!changes)
+		return;
+
+	if (changes & PRISMRIVER_CHANGED_EDGE) {
+		ev.flags |= PRISMRIVER_EVF_EDGE;
+		guitar_keys_frame(sc, frame);
+	}
+
+	*last = *frame;
+
+	/* Set by sony_input_configured() after hid_hw_start() enabled reports */
+	chan = READ_ONCE(sc->chan);
+	if (!chan)
+		return;
+
+	guitar_chan_publish(chan, &ev);
+
+	if (changes & PRISMRIVER_CHANGED_STRUM)
+		guitar_publish_note(chan, &ev);
+}
+
+/*
+ * URBs on the same endpoint complete in the order they were queued, so
+ * reports reach the HID core in order whichever URB, ours or usbhid's,
+ * carried them.
+ */
+static void guitar_urb_complete(struct urb *urb)
+{
+	struct sony_sc *sc = urb->context;
+	struct guitar_urbs *urbs = &sc->urbs;
+	unsigned int i;
+	int ret;
+
+	switch (urb->status) {
+	case 0:
+		hid_input_report(sc->hdev, HID_INPUT_REPORT,
+				 urb->transfer_buffer, urb->actual_length, 1);
+		break;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+	case -EPERM:
+		return;
+	case -EPIPE:
+	case -EILSEQ:
+	case -EPROTO:
+	case -ETIME:
+	case -ETIMEDOUT:
+		/*
+		 * Stall, or a protocol error that may well be an unplug:
+		 * as usbhid does, do not hammer the endpoint but rest the
+		 * URB, and clear the halt first after a stall.
+		 */
+		if (urb->status == -EPIPE)
+			WRITE_ONCE(urbs->halted, true);
+		for (i = 0; i < urbs->count; i++)
+			if (urbs->urbs[i] == urb)
+				set_bit(i, &urbs->stopped);
+		schedule_delayed_work(&urbs->retry,
+				      msecs_to_jiffies(GUITAR_URB_RETRY_MS));
+		return;
+	default:
+		/* Other transient errors, e.g. -EOVERFLOW, just poll again */
+		break;
+	}
+
+	ret = usb_submit_urb(urb, GFP_ATOMIC);
+	if (ret && ret != -EPERM)
+		hid_err_ratelimited(sc->hdev, "extra URB resubmit failed: %d\n",
+				    ret);
+}
+
+static void guitar_urbs_retry(struct work_struct *work)
+{
+	struct guitar_urbs *urbs = container_of(to_delayed_work(work),
+						struct guitar_urbs, retry);
+	struct sony_sc *sc = container_of(urbs, struct sony_sc, urbs);
+	unsigned int i;
+	int ret;
+
+	mutex_lock(&urbs->lock);
+
+	if (urbs->suspended || !urbs->count)
+		goto out;
+
+	if (urbs->halted) {
+		urbs->halted = false;
+		ret = usb_clear_halt(sc->usbdev, urbs->urbs[0]->pipe);
+		if (ret)
+			hid_warn(sc->hdev, "extra URB clear halt failed: %d\n",
+				 ret);
+	}
+
+	for (i = 0; i < urbs->count; i++) {
+		if (!test_and_clear_bit(i, &urbs->stopped))
+			continue;
+		ret = usb_submit_urb(urbs->urbs[i], GFP_KERNEL);
+		if (ret)
+			hid_warn(sc->hdev, "extra URB resubmit failed: %d\n",
+				 ret);
+	}
+
+out:
+	mutex_unlock(&urbs->lock);
+}
+
+/* Called with urbs->lock held */
+static void guitar_urbs_submit(struct sony_sc *sc)
+{
+	struct guitar_urbs *urbs = &sc->urbs;
+	unsigned int i;
+	int ret;
+
+	if (urbs->suspended)
+		return;
+
+	/* All of them are idle here, the stopped ones included */
+	urbs->stopped = 0;
+
+	for (i = 0; i < urbs->count; i++) {
+		ret = usb_submit_urb(urbs->urbs[i], GFP_KERNEL);
+		if (ret)
+			hid_warn(sc->hdev, "extra URB submit failed: %d\n", ret);
+	}
+}
+
+/* Called with urbs->lock held */
+static void guitar_urbs_kill(struct sony_sc *sc)
+{
+	struct guitar_urbs *urbs = &sc->urbs;
+	unsigned int i;
+
+	for (i = 0; i < urbs->count; i++)
+		usb_kill_urb(urbs->urbs[i]);
+}
+
+/* Called with urbs->lock held */
+static void guitar_urbs_free(struct sony_sc *sc)
+{
+	struct guitar_urbs *urbs = &sc->urbs;
+	struct urb *urb;
+
+	guitar_urbs_kill(sc);
+
+	while (urbs->count) {
+		urb = urbs->urbs[--urbs->count];
+		usb_free_coherent(sc->usbdev, urb->transfer_buffer_length,
+				  urb->transfer_buffer, urb->transfer_dma);
+		usb_free_urb(urb);
+	}
+	urbs->stopped = 0;
+}
+
+/* Called with urbs->lock held */
+static int guitar_urbs_alloc(struct sony_sc *sc, unsigned int count)
+{
+	struct guitar_urbs *urbs = &sc->urbs;
+	struct usb_endpoint_descriptor *ep;
+	struct usb_interface *intf;
+	struct urb *urb;
+	unsigned int maxp;
+	void *buf;
+	int ret;
+
+	intf = to_usb_interface(sc->hdev->dev.parent);
+	ret = usb_find_int_in_endpoint(intf->cur_altsetting, &ep);
+	if (ret)
+		return ret;
+
+	maxp = usb_endpoint_maxp(ep);
+
+	while (urbs->count < count) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			return -ENOMEM;
+
+		buf = usb_alloc_coherent(sc->usbdev, maxp, GFP_KERNEL,
+					 &urb->transfer_dma);
+		if (!buf) {
+			usb_free_urb(urb);
+			return -ENOMEM;
+		}
+
+		usb_fill_int_urb(urb, sc->usbdev,
+				 usb_rcvintpipe(sc->usbdev, ep->bEndpointAddress),
+				 buf, maxp, guitar_urb_complete, sc,
+				 ep->bInterval);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+		urbs->urbs[urbs->count++] = urb;
+	}
+
+	return 0;
+}
+
+static ssize_t extra_urbs_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sc->urbs.count));
+}
+
+static ssize_t extra_urbs_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	unsigned int n;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &n);
+	if (ret)
+		return ret;
+
+	if (n > GUITAR_MAX_URBS)
+		return -EINVAL;
+
+	if (!sc->usbdev)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&sc->urbs.lock);
+	guitar_urbs_free(sc);
+	ret = guitar_urbs_alloc(sc, n);
+	if (ret)
+		guitar_urbs_free(sc);
+	else
+		guitar_urbs_submit(sc);
+	mutex_unlock(&sc->urbs.lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(extra_urbs);
+
+/*
+ * Per-device polling interval override. usbhid takes the interval of its
+ * interrupt URB from the endpoint descriptor when it starts the device, and
+ * xHCI programs it into the endpoint context when the interface's endpoints
+ * are added, so the override patches bInterval in the in-memory descriptor
+ * and then rebinds the interface with its endpoints reinstalled. Unlike
+ * usbhid's jspoll this affects no other device, and it lasts until the
+ * dongle is enumerated again. The guitar goes away and comes back during
+ * the rebind, which therefore runs from a work item. The achieved rate
+ * shows in the arrival histogram in debugfs, whose nominal interval is
+ * taken from the patched descriptor.
+ */
+#define GUITAR_POLL_INTERVAL_MAX_MS 255
+
+struct guitar_rebind {
+	struct work_struct work;
+	struct usb_interface *intf;
+};
+
+static struct workqueue_struct *prismriver_wq;
+
+static void guitar_rebind_work(struct work_struct *work)
+{
+	struct guitar_rebind *rb = container_of(work, struct guitar_rebind, work);
+	struct usb_interface *intf = rb->intf;
+	struct usb_device *udev = interface_to_usbdev(intf);
+	struct usb_host_interface *alt;
+	int ret;
+
+	usb_lock_device(udev);
+	if (udev->state != USB_STATE_NOTATTACHED) {
+		device_release_driver(&intf->dev);
+
+		/* Drop and add the endpoints, so that the HCD sees the interval */
+		alt = intf->cur_altsetting;
+		ret = usb_set_interface(udev, alt->desc.bInterfaceNumber,
+					alt->desc.bAlternateSetting);
+		if (ret)
+			dev_warn(&intf->dev, "set interface failed: %d\n", ret);
+
+		ret = device_attach(&intf->dev);
+		if (ret < 0)
+			dev_warn(&intf->dev, "rebind failed: %d\n", ret);
+	}
+	usb_unlock_device(udev);
+
+	usb_put_intf(intf);
+	kfree(rb);
+}
+
+/* bInterval of the endpoint as the device reported it, 0 if not found */
+static u8 guitar_advertised_interval(struct usb_device *udev, u8 address)
+{
+	int cfg = udev->actconfig - udev->config;
+	const u8 *p = udev->rawdescriptors[cfg];
+	unsigned int len = le16_to_cpu(udev->actconfig->desc.wTotalLength);
+
+	while (len >= 2 && p[0] >= 2 && p[0] <= len) {
+		if (p[1] == USB_DT_ENDPOINT && p[0] >= USB_DT_ENDPOINT_SIZE &&
+		    p[2] == address)
+			return p[6];
+		len -= p[0];
+		p += p[0];
+	}
+
+	return 0;
+}
+
+static unsigned int guitar_interval_to_ms(struct usb_device *udev, u8 interval)
+{
+	if (udev->speed >= USB_SPEED_HIGH)
+		return max(1U << (clamp_val(interval, 1, 16) - 1) >> 3, 1U);
+
+	return interval;
+}
+
+/* Rounded down to a power of two at high speed */
+static u8 guitar_ms_to_interval(struct usb_device *udev, unsigned int ms)
+{
+	if (udev->speed >= USB_SPEED_HIGH)
+		return min(ilog2(ms * 8) + 1, 16);
+
+	return ms;
+}
+
+static ssize_t poll_interval_ms_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	struct usb_endpoint_descriptor *ep;
+	struct usb_interface *intf;
+
+	if (!sc->usbdev)
+		return -EOPNOTSUPP;
+
+	intf = to_usb_interface(sc->hdev->dev.parent);
+	if (usb_find_int_in_endpoint(intf->cur_altsetting, &ep))
+		return -ENODEV;
+
+	return sysfs_emit(buf, "%u\n",
+			  guitar_interval_to_ms(sc->usbdev, ep->bInterval));
+}
+
+static ssize_t poll_interval_ms_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	struct usb_endpoint_descriptor *ep;
+	struct usb_interface *intf;
+	struct guitar_rebind *rb;
+	unsigned int ms;
+	u8 interval;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &ms);
+	if (ret)
+		return ret;
+
+	/* 0 restores the advertised interval */
+	if (ms > GUITAR_POLL_INTERVAL_MAX_MS)
+		return -EINVAL;
+
+	if (!sc->usbdev || sc->usbdev->speed == USB_SPEED_LOW)
+		return -EOPNOTSUPP;
+
+	intf = to_usb_interface(sc->hdev->dev.parent);
+	ret = usb_find_int_in_endpoint(intf->cur_altsetting, &ep);
+	if (ret)
+		return ret;
+
+	if (ms)
+		interval = guitar_ms_to_interval(sc->usbdev, ms);
+	else
+		interval = guitar_advertised_interval(sc->usbdev,
+						      ep->bEndpointAddress);
+	if (!interval)
+		return -ENODEV;
+
+	if (interval == ep->bInterval)
+		return count;
+
+	rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+	if (!rb)
+		return -ENOMEM;
+
+	hid_info(sc->hdev, "polling interval %u ms, rebinding\n",
+		 guitar_interval_to_ms(sc->usbdev, interval));
+
+	ep->bInterval = interval;
+
+	INIT_WORK(&rb->work, guitar_rebind_work);
+	rb->intf = usb_get_intf(intf);
+	queue_work(prismriver_wq, &rb->work);
+
+	return count;
+}
+static DEVICE_ATTR_RW(poll_interval_ms);
+
+static ssize_t busy_poll_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+
+	return sysfs_emit(buf, "%d\n", sc->chan ? READ_ONCE(sc->chan->busy_poll) : 0);
+}
+
+static ssize_t busy_poll_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	struct guitar_chan *chan = sc->chan;
+	unsigned long flags;
+	bool enable;
+	int ret;
+
+	if (!chan)
+		return -ENODEV;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&chan->lock, flags);
+	chan->busy_poll = enable;
+	if (enable)
+		chan->ring->flags |= PRISMRIVER_RING_BUSY_POLL;
+	else
+		chan->ring->flags &= ~PRISMRIVER_RING_BUSY_POLL;
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	return count;
+}
+static DEVICE_ATTR_RW(busy_poll);
+
+/*
+ * "ktime", the default, stamps reports with CLOCK_MONOTONIC at handling
+ * time, at full ktime resolution. "usb_frame" stamps them with the start
+ * of their USB frame, see guitar_frame_time(), at 1 ms resolution.
+ */
+static ssize_t timestamp_source_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+
+	return sysfs_emit(buf, "%s\n",
+			  READ_ONCE(sc->frame_timestamps) ? "usb_frame" : "ktime");
+}
+
+static ssize_t timestamp_source_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	unsigned long flags;
+	bool frame;
+
+	if (sysfs_streq(buf, "usb_frame"))
+		frame = true;
+	else if (sysfs_streq(buf, "ktime"))
+		frame = false;
+	else
+		return -EINVAL;
+
+	if (frame && !sc->usbdev)
+		return -EOPNOTSUPP;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	sc->frame_clock.valid = false;
+	sc->latency.samples = 0;
+	WRITE_ONCE(sc->frame_timestamps, frame);
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	return count;
+}
+static DEVICE_ATTR_RW(timestamp_source);
+
+/*
+ * Current frame clock correlation: extended frame count of the last
+ * report, monotonic time of that frame's start and of the report's
+ * handling, for calibrating against other clocks.
+ */
+static ssize_t frame_clock_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	struct guitar_frame_clock clock;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	clock = sc->frame_clock;
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	if (!clock.valid)
+		return sysfs_emit(buf, "unsynchronized\n");
+
+	return sysfs_emit(buf, "frame %llu frame_ns %llu report_ns %llu\n",
+			  clock.frame,
+			  clock.epoch_ns + clock.frame * NSEC_PER_MSEC,
+			  clock.last_ns);
+}
+static DEVICE_ATTR_RO(frame_clock);
+
+/*
+ * Rolling average and mean deviation of the time from the report
+ * timestamp to input_sync(), and the average report interval. With
+ * usb_frame timestamps the former includes the bus to driver delay.
+ */
+static ssize_t latency_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct sony_sc *sc = hid_get_drvdata(to_hid_device(dev));
+	struct guitar_latency lat;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	lat = sc->latency;
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	return sysfs_emit(buf,
+			  "pipeline_ns %lld pipeline_dev_ns %lld interval_ns %lld samples %llu\n",
+			  lat.pipeline_ns, lat.pipeline_dev_ns, lat.interval_ns,
+			  lat.samples);
+}
+static DEVICE_ATTR_RO(latency);
+
+static struct attribute *sony_attrs[] = {
+	&dev_attr_busy_poll.attr,
+	&dev_attr_timestamp_source.attr,
+	&dev_attr_frame_clock.attr,
+	&dev_attr_latency.attr,
+	&dev_attr_extra_urbs.attr,
+	&dev_attr_poll_interval_ms.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(sony);
+
+/*
+ * Hold back an axis change that comes too soon after the last one. Returns
+ * 1 if it is held back, 0 to let hid-input emit it now.
+ */
+static int guitar_axis_event(struct sony_sc *sc, enum guitar_axis_id id,
+			     struct input_dev *input, unsigned int code,
+			     s32 value)
+{
+	struct guitar_axes *axes = &sc->axes;
+	struct guitar_axis *ax = &axes->axis[id];
+	unsigned long flags;
+	int held = 0;
+	u64 now, end;
+
+	if (!READ_ONCE(ax->interval_ns))
+		return 0;
+
+	now = ktime_get_ns();
+
+	spin_lock_irqsave(&sc->lock, flags);
+	if (!ax->interval_ns)
+		goto out;
+
+	ax->input = input;
+	ax->code = code;
+
+	/* hid-input reports every value of every report */
+	if (value == ax->value) {
+		held = ax->pending;
+		goto out;
+	}
+	ax->value = value;
+
+	end = ax->last_ns + ax->interval_ns;
+	if (!ax->pending && now >= end) {
+		ax->last_ns = now;
+		goto out;
+	}
+
+	held = 1;
+	if (!ax->pending) {
+		ax->pending = true;
+		/*
+		 * Only ever bring the timer forward. While its callback runs,
+		 * @expires_ns is what it re-arms for, see guitar_axes_flush().
+		 */
+		if (end < axes->expires_ns) {
+			axes->expires_ns = end;
+			hrtimer_start(&axes->flush_timer, ns_to_ktime(end),
+				      HRTIMER_MODE_ABS);
+		}
+	}
+out:
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	return held;
+}
+
+/*
+ * Take the held back changes whose window is over into @flush, with
+ * sc->lock held. Returns how many, and sets @next to the end of the
+ * earliest window still running, U64_MAX if none.
+ */
+static int guitar_axes_collect(struct guitar_axes *axes, u64 now,
+			       struct guitar_axis *flush, u64 *next)
+{
+	struct guitar_axis *ax;
+	int i, n = 0;
+	u64 end;
+
+	*next = U64_MAX;
+
+	for (i = 0; i < GUITAR_AXES; i++) {
+		ax = &axes->axis[i];
+		if (!ax->pending)
+			continue;
+
+		end = ax->last_ns + ax->interval_ns;
+		if (now < end) {
+			*next = min(*next, end);
+			continue;
+		}
+
+		ax->pending = false;
+		ax->last_ns = now;
+		flush[n++] = *ax;
+	}
+
+	return n;
+}
+
+static void guitar_axes_emit(const struct guitar_axis *flush, int n,
+			     bool sync)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		input_event(flush[i].input, EV_ABS, flush[i].code,
+			    flush[i].value);
+		if (sync && (i == n - 1 || flush[i + 1].input != flush[i].input))
+			input_sync(flush[i].input);
+	}
+}
+
+static enum hrtimer_restart guitar_axes_flush(struct hrtimer *timer)
+{
+	struct guitar_axes *axes = container_of(timer, struct guitar_axes,
+						flush_timer);
+	struct sony_sc *sc = container_of(axes, struct sony_sc, axes);
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	struct guitar_axis flush[GUITAR_AXES];
+	u64 now = ktime_get_ns(), next;
+	unsigned long flags;
+	int n = 0;
+
+	spin_lock_irqsave(&axes->emit_lock, flags);
+	spin_lock(&sc->lock);
+
+	if (axes->in_report && now - axes->report_ns < GUITAR_AXES_REPORT_NS) {
+		/* The report flushes what is due, look again after it */
+		next = now + GUITAR_AXES_DEFER_NS;
+	} else {
+		n = guitar_axes_collect(axes, now, flush, &next);
+	}
+
+	/*
+	 * Under the lock, so that guitar_axis_event() sees what the timer
+	 * re-arms for and only starts it for an earlier window.
+	 */
+	axes->expires_ns = next;
+	if (next != U64_MAX) {
+		hrtimer_set_expires(timer, ns_to_ktime(next));
+		restart = HRTIMER_RESTART;
+	}
+	spin_unlock(&sc->lock);
+
+	guitar_axes_emit(flush, n, true);
+	spin_unlock_irqrestore(&axes->emit_lock, flags);
+
+	return restart;
+}
+
+/* From raw_event, see struct guitar_axes */
+static void guitar_axes_report_begin(struct sony_sc *sc)
+{
+	struct guitar_axes *axes = &sc->axes;
+	unsigned long flags;
+
+	spin_lock_irqsave(&axes->emit_lock, flags);
+	axes->in_report = true;
+	axes->report_ns = ktime_get_ns();
+	spin_unlock_irqrestore(&axes->emit_lock, flags);
+}
+
+/* Emit the changes that are due, before the report callback syncs */
+static void guitar_axes_report_flush(struct sony_sc *sc)
+{
+	struct guitar_axis flush[GUITAR_AXES];
+	unsigned long flags;
+	u64 next;
+	int n;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	n = guitar_axes_collect(&sc->axes, ktime_get_ns(), flush, &next);
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	guitar_axes_emit(flush, n, false);
+}
+
+static void guitar_axes_report_end(struct sony_sc *sc)
+{
+	struct guitar_axes *axes = &sc->axes;
+	unsigned long flags;
+
+	spin_lock_irqsave(&axes->emit_lock, flags);
+	axes->in_report = false;
+	spin_unlock_irqrestore(&axes->emit_lock, flags);
+}
+
+/* Before the input devices go away with hid_hw_stop() */
+static void guitar_axes_stop(struct sony_sc *sc)
+{
+	struct guitar_axes *axes = &sc->axes;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	axes->dead = true;
+	for (i = 0; i < GUITAR_AXES; i++) {
+		axes->axis[i].interval_ns = 0;
+		axes->axis[i].pending = false;
+	}
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	hrtimer_cancel(&axes->flush_timer);
+}
+
+static int sony_raw_event(struct hid_device *hdev, struct hid_report *report,
+		u8 *rd, int size)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+	u64 now;
+	u32 seq;
+
+	if (sc->quirks & GH_GUITAR_CONTROLLER) {
+		sc->cost.start = get_cycles();
+		guitar_axes_report_begin(sc);
+		now = guitar_report_time(sc);
+
+		seq = guitar_record(sc->recorder, rd, size, now);
+		if (READ_ONCE(sc->capture))
+			guitar_capture(sc, rd, size, now, seq);
+
+		guitar_parse_report(sc, rd, size, now);
+	}
+
+	return 0;
+}
+
+static int sony_event(struct hid_device *hdev, struct hid_field *field,
+		      struct hid_usage *usage, __s32 value)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+
+	if (!(sc->quirks & GH_GUITAR_CONTROLLER) || usage->type != EV_ABS ||
+	    !field->hidinput)
+		return 0;
+
+	if (usage->hid == HID_GD_Z)
+		return guitar_axis_event(sc, GUITAR_AXIS_WHAMMY,
+					 field->hidinput->input, usage->code,
+					 value);
+
+	if (usage->hid == (HID_UP_MSVENDOR | GUITAR_TILT_USAGE))
+		return guitar_axis_event(sc, GUITAR_AXIS_TILT,
+					 field->hidinput->input, usage->code,
+					 value);
+
+	return 0;
+}
+
+static int guitar_arrival_show(struct seq_file *s, void *unused)
+{
+	struct sony_sc *sc = s->private;
+	struct guitar_arrival arr;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	arr = sc->arrival;
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	seq_printf(s, "nominal_interval_ns %llu\n", arr.nominal_ns);
+	seq_printf(s, "gaps %llu\n", arr.gaps);
+
+	for (i = 0; i < GUITAR_HIST_BUCKETS; i++) {
+		if (!arr.hist[i])
+			continue;
+
+		if (!i)
+			seq_printf(s, "%10s us %llu\n", "<1", arr.hist[i]);
+		else if (i == GUITAR_HIST_BUCKETS - 1)
+			seq_printf(s, "%9llu+ us %llu\n", 1ULL << (i - 1),
+				   arr.hist[i]);
+		else
+			seq_printf(s, "%10llu us %llu\n", 1ULL << (i - 1),
+				   arr.hist[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(guitar_arrival);
+
+/*
+ * Polling interval advertised by the interrupt in endpoint, or 0 when it
+ * cannot be found and the measured average has to stand in for it.
+ */
+static u64 guitar_nominal_interval_ns(struct sony_sc *sc)
+{
+	struct usb_endpoint_descriptor *ep;
+	struct usb_interface *intf;
+
+	if (!sc->usbdev)
+		return 0;
+
+	intf = to_usb_interface(sc->hdev->dev.parent);
+	if (usb_find_int_in_endpoint(intf->cur_altsetting, &ep))
+		return 0;
+
+	if (sc->usbdev->speed >= USB_SPEED_HIGH)
+		return (NSEC_PER_MSEC / 8) << (clamp_val(ep->bInterval, 1, 16) - 1);
+
+	return ep->bInterval * NSEC_PER_MSEC;
+}
+
+/*
+ * Snapshot the flight recorder at open time, dropping the records that
+ * are rewritten while they are being copied.
+ */
+static int guitar_recorder_open(struct inode *inode, struct file *file)
+{
+	struct sony_sc *sc = inode->i_private;
+	struct guitar_recorder *rec = sc->recorder;
+	struct prismriver_recorder_header *hdr;
+	struct prismriver_raw_record *out, *r;
+	struct debugfs_blob_wrapper *blob;
+	u32 head, seq, i, count = 0;
+
+	blob = kzalloc(sizeof(*blob) + sizeof(*hdr) +
+		       GUITAR_RECORDER_SIZE * sizeof(*out), GFP_KERNEL);
+	if (!blob)
+		return -ENOMEM;
+
+	hdr = (void *)(blob + 1);
+	out = (void *)(hdr + 1);
+
+	head = smp_load_acquire(&rec->head);
+	for (i = head - min_t(u32, head, GUITAR_RECORDER_SIZE); i != head; i++) {
+		r = &rec->recs[i & (GUITAR_RECORDER_SIZE - 1)];
+
+		seq = READ_ONCE(r->seq);
+		smp_rmb();
+		out[count] = *r;
+		smp_rmb();
+		if (seq != i || READ_ONCE(r->seq) != seq)
+			continue;
+
+		out[count++].seq = seq;
+	}
+
+	hdr->magic = PRISMRIVER_RECORDER_MAGIC;
+	hdr->version = PRISMRIVER_RECORDER_VERSION;
+	hdr->record_size = sizeof(*out);
+	hdr->count = count;
+
+	blob->data = hdr;
+	blob->size = sizeof(*hdr) + count * sizeof(*out);
+	file->private_data = blob;
+
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t guitar_recorder_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct debugfs_blob_wrapper *blob = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, blob->data, blob->size);
+}
+
+static int guitar_recorder_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations guitar_recorder_fops = {
+	.owner   = THIS_MODULE,
+	.open    = guitar_recorder_open,
+	.read    = guitar_recorder_read,
+	.release = guitar_recorder_release,
+};
+
+static struct dentry *guitar_capture_create_buf_file(const char *filename,
+						     struct dentry *parent,
+						     umode_t mode,
+						     struct rchan_buf *buf,
+						     int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static int guitar_capture_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+
+	return 0;
+}
+
+/*
+ * Without a subbuf_start callback relay stops writing to a CPU buffer
+ * once it is full, so a slow reader loses the newest reports, which
+ * shows up as a gap in the record sequence numbers.
+ */
+static const struct rchan_callbacks guitar_capture_callbacks = {
+	.create_buf_file = guitar_capture_create_buf_file,
+	.remove_buf_file = guitar_capture_remove_buf_file,
+};
+
+/* Called with sc->capture_lock held */
+static int guitar_capture_start(struct sony_sc *sc)
+{
+	struct rchan *chan;
+	unsigned long flags;
+
+	if (sc->capture)
+		return 0;
+
+	chan = relay_open("capture", sc->debugfs,
+			  GUITAR_CAPTURE_SUBBUF_RECORDS *
+			  sizeof(struct prismriver_raw_record),
+			  GUITAR_CAPTURE_SUBBUFS, &guitar_capture_callbacks,
+			  NULL);
+	if (!chan)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	sc->capture = chan;
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	return 0;
+}
+
+/* Called with sc->capture_lock held */
+static void guitar_capture_stop(struct sony_sc *sc)
+{
+	struct rchan *chan;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sc->lock, flags);
+	chan = sc->capture;
+	sc->capture = NULL;
+	spin_unlock_irqrestore(&sc->lock, flags);
+
+	if (chan)
+		relay_close(chan);
+}
+
+static int guitar_capture_ctl_show(struct seq_file *s, void *unused)
+{
+	struct sony_sc *sc = s->private;
+
+	seq_printf(s, "%d\n", READ_ONCE(sc->capture) ? 1 : 0);
+
+	return 0;
+}
+
+static int guitar_capture_ctl_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, guitar_capture_ctl_show, inode->i_private);
+}
+
+/*
+ * "1" opens the relay channel, one captureN file per CPU next to this
+ * one, "0" closes it again. "flush" makes the partially filled
+ * sub-buffers readable, so that a reader can drain everything before
+ * closing.
+ */
+static ssize_t guitar_capture_ctl_write(struct file *file,
+					const char __user *ubuf,
+					size_t count, loff_t *ppos)
+{
+	struct sony_sc *sc = ((struct seq_file *)file->private_data)->private;
+	char buf[8] = {};
+	bool enable;
+	int ret = 0;
+
+	if (copy_from_user(buf, ubuf, min(count, sizeof(buf) - 1)))
+		return -EFAULT;
+
+	mutex_lock(&sc->capture_lock);
+
+	if (sysfs_streq(buf, "flush")) {
+		if (sc->capture)
+			relay_flush(sc->capture);
+	} else {
+		ret = kstrtobool(buf, &enable);
+		if (!ret && enable)
+			ret = guitar_capture_start(sc);
+		else if (!ret)
+			guitar_capture_stop(sc);
+	}
+
+	mutex_unlock(&sc->capture_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations guitar_capture_ctl_fops = {
+	.owner   = THIS_MODULE,
+	.open    = guitar_capture_ctl_open,
+	.read    = seq_read,
+	.write   = guitar_capture_ctl_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+static enum hrtimer_restart guitar_inject_timer(struct hrtimer *timer)
+{
+	struct guitar_injector *inj = container_of(timer, struct guitar_injector,
+						   timer);
+	struct sony_sc *sc = container_of(inj, struct sony_sc, inject);
+	const u8 *rec = inj->records + inj->pos * (4 + inj->report_size);
+	u64 late = ktime_get_ns() - inj->next_ns;
+
+	inj->lateness_ns += late;
+	inj->max_late_ns = max(inj->max_late_ns, late);
+
+	/* raw_event handlers may modify the report, so hand them a copy */
+	memcpy(inj->report, rec + 4, inj->report_size);
+	hid_input_report(sc->hdev, HID_INPUT_REPORT, inj->report,
+			 inj->report_size, 1);
+
+	if (++inj->pos == inj->count)
+		return HRTIMER_NORESTART;
+
+	inj->next_ns += get_unaligned_le32(rec + 4 + inj->report_size);
+	hrtimer_set_expires(timer, ns_to_ktime(inj->next_ns));
+
+	return HRTIMER_RESTART;
+}
+
+/* Called with inj->lock held */
+static void guitar_inject_stop(struct guitar_injector *inj)
+{
+	hrtimer_cancel(&inj->timer);
+	kvfree(inj->capture);
+	inj->capture = NULL;
+	inj->count = inj->pos = 0;
+}
+
+/*
+ * Validate the header of an uploaded capture, once it is in. Returns the
+ * length of the whole capture, or a negative error.
+ */
+static ssize_t guitar_inject_check(const u8 *buf)
+{
+	const struct prismriver_cap_header *hdr = (const void *)buf;
+	u16 header_size, rdesc_size, report_size;
+	u64 total;
+	u32 count;
+
+	if (get_unaligned_le32(&hdr->magic) != PRISMRIVER_CAP_MAGIC ||
+	    get_unaligned_le16(&hdr->version) != PRISMRIVER_CAP_VERSION)
+		return -EINVAL;
+
+	header_size = get_unaligned_le16(&hdr->header_size);
+	rdesc_size = get_unaligned_le16(&hdr->rdesc_size);
+	report_size = get_unaligned_le16(&hdr->report_size);
+	count = get_unaligned_le32(&hdr->count);
+
+	if (header_size < sizeof(*hdr) || !report_size ||
+	    report_size > GUITAR_INJECT_REPORT_MAX || !count)
+		return -EINVAL;
+
+	total = (u64)header_size + rdesc_size + (u64)count * (4 + report_size);
+	if (total > GUITAR_INJECT_MAX_SIZE)
+		return -EFBIG;
+
+	return total;
+}
+
+/*
+ * Start replaying a complete, checked capture. The first record is fed
+ * in right away, the following ones at their recorded offsets. Called
+ * with inj->lock held.
+ */
+static void guitar_inject_start(struct guitar_injector *inj, u8 *buf)
+{
+	struct prismriver_cap_header *hdr = (void *)buf;
+
+	guitar_inject_stop(inj);
+
+	inj->capture = buf;
+	inj->records = buf + get_unaligned_le16(&hdr->header_size) +
+		       get_unaligned_le16(&hdr->rdesc_size);
+	inj->count = get_unaligned_le32(&hdr->count);
+	inj->report_size = get_unaligned_le16(&hdr->report_size);
+	inj->max_late_ns = inj->lateness_ns = 0;
+	inj->next_ns = ktime_get_ns();
+
+	hrtimer_start(&inj->timer, ns_to_ktime(inj->next_ns),
+		      HRTIMER_MODE_ABS_SOFT);
+}
+
+static int guitar_inject_open(struct inode *inode, struct file *file)
+{
+	struct guitar_inject_upload *up;
+
+	up = kzalloc(sizeof(*up), GFP_KERNEL);
+	if (!up)
+		return -ENOMEM;
+
+	up->sc = inode->i_private;
+	file->private_data = up;
+
+	return nonseekable_open(inode, file);
+}
+
+static void guitar_inject_reset(struct guitar_inject_upload *up)
+{
+	kvfree(up->buf);
+	up->buf = NULL;
+	up->len = up->size = up->total = 0;
+}
+
+/*
+ * The replay starts from the write that completes a capture, and writing
+ * "stop" instead of a capture stops it. Both happen here rather than at
+ * close: debugfs keeps the guitar around for the duration of a write,
+ * but not for the release of a file whose guitar went away.
+ */
+static ssize_t guitar_inject_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct guitar_inject_upload *up = file->private_data;
+	struct guitar_injector *inj = &up->sc->inject;
+	size_t size, limit;
+	ssize_t total;
+	char cmd[8];
+	u8 *buf;
+	int ret = 0;
+
+	if (!up->len && count < sizeof(cmd)) {
+		if (copy_from_user(cmd, ubuf, count))
+			return -EFAULT;
+		cmd[count] = '\0';
+
+		if (sysfs_streq(cmd, "stop")) {
+			mutex_lock(&inj->lock);
+			if (inj->dead)
+				ret = -ENODEV;
+			else
+				guitar_inject_stop(inj);
+			mutex_unlock(&inj->lock);
+
+			return ret ? ret : count;
+		}
+	}
+
+	limit = up->total ? up->total : GUITAR_INJECT_MAX_SIZE;
+	if (count > limit - up->len)
+		return up->total ? -EINVAL : -EFBIG;
+
+	if (up->len + count > up->size) {
+		size = max(2 * up->size, up->len + count);
+		size = min_t(size_t, size, limit);
+
+		buf = kvmalloc(size, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+
+		if (up->buf)
+			memcpy(buf, up->buf, up->len);
+		kvfree(up->buf);
+		up->buf = buf;
+		up->size = size;
+	}
+
+	if (copy_from_user(up->buf + up->len, ubuf, count))
+		return -EFAULT;
+	up->len += count;
+
+	if (!up->total && up->len >= sizeof(struct prismriver_cap_header)) {
+		total = guitar_inject_check(up->buf);
+		if (total < 0 || total < up->len) {
+			guitar_inject_reset(up);
+			return total < 0 ? total : -EINVAL;
+		}
+		up->total = total;
+	}
+
+	if (!up->total || up->len < up->total)
+		return count;
+
+	mutex_lock(&inj->lock);
+	if (inj->dead) {
+		ret = -ENODEV;
+	} else {
+		guitar_inject_start(inj, up->buf);
+		up->buf = NULL;
+	}
+	mutex_unlock(&inj->lock);
+
+	guitar_inject_reset(up);
+
+	return ret ? ret : count;
+}
+
+/* Must not touch the guitar, which may be gone by now */
+static int guitar_inject_release(struct inode *inode, struct file *file)
+{
+	struct guitar_inject_upload *up = file->private_data;
+
+	guitar_inject_reset(up);
+	kfree(up);
+
+	return 0;
+}
+
+static const struct file_operations guitar_inject_fops = {
+	.owner   = THIS_MODULE,
+	.open    = guitar_inject_open,
+	.write   = guitar_inject_write,
+	.release = guitar_inject_release,
+};
+
+static int guitar_inject_status_show(struct seq_file *s, void *unused)
+{
+	struct sony_sc *sc = s->private;
+	struct guitar_injector *inj = &sc->inject;
+	u32 pos;
+
+	mutex_lock(&inj->lock);
+	pos = READ_ONCE(inj->pos);
+	seq_printf(s, "state %s\n",
+		   inj->capture && pos < inj->count ? "playing" : "idle");
+	seq_printf(s, "position %u/%u\n", pos, inj->count);
+	seq_printf(s, "max_late_ns %llu\n", READ_ONCE(inj->max_late_ns));
+	seq_printf(s, "mean_late_ns %llu\n",
+		   pos ? div_u64(READ_ONCE(inj->lateness_ns), pos) : 0);
+	mutex_unlock(&inj->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(guitar_inject_status);
+
+static void guitar_debugfs_exit(struct sony_sc *sc)
+{
+	mutex_lock(&sc->capture_lock);
+	guitar_capture_stop(sc);
+	mutex_unlock(&sc->capture_lock);
+
+	mutex_lock(&sc->inject.lock);
+	sc->inject.dead = true;
+	guitar_inject_stop(&sc->inject);
+	mutex_unlock(&sc->inject.lock);
+
+	debugfs_remove_recursive(sc->debugfs);
+}
+
+static int guitar_cost_show(struct seq_file *s, void *unused)
+{
+	struct sony_sc *sc = s->private;
+	u64 reports = READ_ONCE(sc->cost.reports);
+	u64 cycles = READ_ONCE(sc->cost.cycles);
+
+	seq_printf(s, "reports %llu\n", reports);
+	seq_printf(s, "cycles %llu\n", cycles);
+	seq_printf(s, "cycles_per_report %llu\n",
+		   reports ? div64_u64(cycles, reports) : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(guitar_cost);
+
+static void guitar_debugfs_init(struct sony_sc *sc)
+{
+	sc->arrival.nominal_ns = guitar_nominal_interval_ns(sc);
+
+	sc->debugfs = debugfs_create_dir(dev_name(&sc->hdev->dev),
+					 prismriver_debugfs_root);
+	debugfs_create_file("arrival", 0444, sc->debugfs, sc,
+			    &guitar_arrival_fops);
+	debugfs_create_file("flight_recorder", 0400, sc->debugfs, sc,
+			    &guitar_recorder_fops);
+	debugfs_create_file("capture", 0600, sc->debugfs, sc,
+			    &guitar_capture_ctl_fops);
+	debugfs_create_file("inject", 0200, sc->debugfs, sc,
+			    &guitar_inject_fops);
+	debugfs_create_file("inject_status", 0444, sc->debugfs, sc,
+			    &guitar_inject_status_fops);
+	debugfs_create_file("cost", 0444, sc->debugfs, sc, &guitar_cost_fops);
+}
+
+static void sony_report(struct hid_device *hdev, struct hid_report *report)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+	struct hid_input *hidinput;
+
+	if (sc->quirks & GH_GUITAR_CONTROLLER) {
+		guitar_axes_report_flush(sc);
+
+		/* HID_QUIRK_NO_INPUT_SYNC is set, the sync is ours */
+		list_for_each_entry(hidinput, &hdev->inputs, list)
+			input_sync(hidinput->input);
+		guitar_axes_report_end(sc);
+
+		guitar_update_pipeline(sc);
+
+		WRITE_ONCE(sc->cost.cycles,
+			   sc->cost.cycles + get_cycles() - sc->cost.start);
+		WRITE_ONCE(sc->cost.reports, sc->cost.reports + 1);
+	}
+}
+
+static void sony_state_worker(struct work_struct *work)
+{
+	struct sony_sc *sc = container_of(work, struct sony_sc, state_worker);
+
+	sc->send_output_report(sc);
+}
+
+static int sony_allocate_output_report(struct sony_sc *sc)
+{
+	return 0;
+}
+
+static void sony_remove_dev_list(struct sony_sc *sc)
+{
+	unsigned long flags;
+
+	if (sc->list_node.next) {
+		spin_lock_irqsave(&sony_dev_list_lock, flags);
+		list_del(&(sc->list_node));
+		spin_unlock_irqrestore(&sony_dev_list_lock, flags);
+	}
+}
+
+static int sony_check_add(struct sony_sc *sc)
+{
+
+		return 0;
+
+}
+
+static int sony_set_device_id(struct sony_sc *sc)
+{
+	int ret;
+
+	/*
+	 * Only guitars get an id, it names their event channel.
+	 */
+	if (sc->quirks & GH_GUITAR_CONTROLLER) {
+		ret = ida_alloc(&sony_device_id_allocator, GFP_KERNEL);
+		if (ret < 0) {
+			sc->device_id = -1;
+			return ret;
+		}
+		sc->device_id = ret;
+	} else {
+		sc->device_id = -1;
+	}
+
+	return 0;
+}
+
+static void sony_release_device_id(struct sony_sc *sc)
+{
+	if (sc->device_id >= 0) {
+		ida_free(&sony_device_id_allocator, sc->device_id);
+		sc->device_id = -1;
+	}
+}
+
+static inline void sony_init_output_report(struct sony_sc *sc,
+				void (*send_output_report)(struct sony_sc *))
+{
+	sc->send_output_report = send_output_report;
+
+	if (!sc->state_worker_initialized)
+		INIT_WORK(&sc->state_worker, sony_state_worker);
+
+	sc->state_worker_initialized = 1;
+}
+
+static inline void sony_cancel_work_sync(struct sony_sc *sc)
+{
+	unsigned long flags;
+
+	if (sc->state_worker_initialized) {
+		spin_lock_irqsave(&sc->lock, flags);
+		sc->state_worker_initialized = 0;
+		spin_unlock_irqrestore(&sc->lock, flags);
+		cancel_work_sync(&sc->state_worker);
+	}
+}
+
+static int sony_input_configured(struct hid_device *hdev,
+					struct hid_input *hidinput)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+	int append_dev_id;
+	int ret;
+
+	ret = sony_set_device_id(sc);
+	if (ret < 0) {
+		hid_err(hdev, "failed to allocate the device id\n");
+		goto err_stop;
+	}
+
+	ret = append_dev_id = sony_check_add(sc);
+	if (ret < 0)
+		goto err_stop;
+
+	ret = sony_allocate_output_report(sc);
+	if (ret < 0) {
+		hid_err(hdev, "failed to allocate the output report buffer\n");
+		goto err_stop;
+	}
+
+	if ((sc->quirks & GH_GUITAR_CONTROLLER) && !sc->keyboard) {
+		ret = guitar_keyboard_create(sc);
+		if (ret < 0) {
+			hid_err(hdev, "failed to register the keyboard\n");
+			goto err_stop;
+		}
+	}
+
+	if ((sc->quirks & GH_GUITAR_CONTROLLER) && !sc->chan) {
+		ret = guitar_chan_create(sc);
+		if (ret < 0) {
+			hid_err(hdev, "failed to register the event channel\n");
+			goto err_stop;
+		}
+	}
+
+	return 0;
+err_stop:
+	sony_cancel_work_sync(sc);
+	sony_remove_dev_list(sc);
+	sony_release_device_id(sc);
+	return ret;
+}
+
+static int sony_probe(struct hid_device *hdev, const struct hid_device_id *id)
+{
+	int ret;
+	unsigned long quirks = id->driver_data;
+	struct sony_sc *sc;
+	unsigned int connect_mask = HID_CONNECT_DEFAULT;
+
+  printk("Versão 5\n");
+
+	sc = devm_kzalloc(&hdev->dev, sizeof(*sc), GFP_KERNEL);
+	if (sc == NULL) {
+		hid_err(hdev, "can't alloc sony descriptor\n");
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&sc->lock);
+	mutex_init(&sc->capture_lock);
+	mutex_init(&sc->urbs.lock);
+	INIT_DELAYED_WORK(&sc->urbs.retry, guitar_urbs_retry);
+	mutex_init(&sc->inject.lock);
+	hrtimer_setup(&sc->inject.timer, guitar_inject_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS_SOFT);
+	spin_lock_init(&sc->keys.lock);
+	hrtimer_setup(&sc->keys.repeat_timer, guitar_keys_repeat,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	hrtimer_setup(&sc->axes.flush_timer, guitar_axes_flush,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sc->axes.expires_ns = U64_MAX;
+	spin_lock_init(&sc->axes.emit_lock);
+
+	sc->quirks = quirks;
+	hid_set_drvdata(hdev, sc);
+	sc->hdev = hdev;
+
+	ret = hid_parse(hdev);
+	if (ret) {
+		hid_err(hdev, "parse failed\n");
+		return ret;
+	}
+
+	if (hid_is_usb(hdev))
+		sc->usbdev = to_usb_device(hdev->dev.parent->parent);
+
+	if (sc->quirks & GH_GUITAR_CONTROLLER) {
+		guitar_build_layout(sc);
+
+		/*
+		 * sony_report() syncs the input devices itself, so that the
+		 * pipeline latency and the cost include the evdev delivery.
+		 */
+		hdev->quirks |= HID_QUIRK_NO_INPUT_SYNC;
+
+		sc->recorder = devm_kzalloc(&hdev->dev, sizeof(*sc->recorder),
+					    GFP_KERNEL);
+		if (!sc->recorder)
+			return -ENOMEM;
+	}
+
+	/*
+	 * hid_hw_start() can fail after sony_input_configured() registered
+	 * the event channel and the keyboard, which have to be unwound too.
+	 */
+	ret = hid_hw_start(hdev, connect_mask);
+	if (ret) {
+		hid_err(hdev, "hw start failed\n");
+		goto err_free;
+	}
+
+	/* sony_input_configured can fail, but this doesn't result
+	 * in hid_hw_start failures (intended). Check whether
+	 * the HID layer claimed the device else fail.
+	 * We don't know the actual reason for the failure, most
+	 * likely it is due to EEXIST in case of double connection
+	 * of USB and Bluetooth, but could have been due to ENOMEM
+	 * or other reasons as well.
+	 */
+	if (!(hdev->claimed & HID_CLAIMED_INPUT)) {
+		hid_err(hdev, "failed to claim input\n");
+		ret = -ENODEV;
+		goto err;
+	}
+
+	if (sc->quirks & GH_GUITAR_CONTROLLER)
+		guitar_debugfs_init(sc);
+
+	return ret;
+
+err:
+	guitar_axes_stop(sc);
+	hid_hw_stop(hdev);
+err_free:
+	sony_remove_dev_list(sc);
+	/* The id names the channel's misc device, free it once that is gone */
+	guitar_chan_destroy(sc);
+	sony_release_device_id(sc);
+	guitar_keyboard_free(sc);
+	return ret;
+}
+
+static void sony_remove(struct hid_device *hdev)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+
+	if (sc->quirks & GH_GUITAR_CONTROLLER) {
+		guitar_debugfs_exit(sc);
+		guitar_axes_stop(sc);
+
+		mutex_lock(&sc->urbs.lock);
+		guitar_urbs_free(sc);
+		mutex_unlock(&sc->urbs.lock);
+		cancel_delayed_work_sync(&sc->urbs.retry);
+	}
+	hid_hw_close(hdev);
+	sony_cancel_work_sync(sc);
+	sony_remove_dev_list(sc);
+	hid_hw_stop(hdev);
+	guitar_chan_destroy(sc);
+	sony_release_device_id(sc);
+	guitar_keyboard_free(sc);
+}
+
+static const struct hid_device_id sony_devices[] = {
+#ifndef PRISMRIVER_USB_DIRECT
+	{ HID_USB_DEVICE(USB_VENDOR_ID_SONY_RHYTHM, USB_DEVICE_ID_SONY_PS3_GUITAR_DONGLE),
+		.driver_data = GH_GUITAR_CONTROLLER },
+#endif
+	{ }
+};
+MODULE_DEVICE_TABLE(hid, sony_devices);
+
+#ifdef CONFIG_PM
+
+static int sony_suspend(struct hid_device *hdev, pm_message_t message)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+
+	mutex_lock(&sc->urbs.lock);
+	guitar_urbs_kill(sc);
+	sc->urbs.suspended = true;
+	mutex_unlock(&sc->urbs.lock);
+
+	return 0;
+}
+
+static int sony_resume(struct hid_device *hdev)
+{
+	struct sony_sc *sc = hid_get_drvdata(hdev);
+
+	mutex_lock(&sc->urbs.lock);
+	sc->urbs.suspended = false;
+	guitar_urbs_submit(sc);
+	mutex_unlock(&sc->urbs.lock);
+
+	return 0;
+}
+
+#endif
+
+static struct hid_driver sony_driver = {
+	.name             = "sony",
+	.id_table         = sony_devices,
+	.input_mapping    = guitar_mapping,
+	.input_configured = sony_input_configured,
+	.raw_event        = sony_raw_event,
+	.event            = sony_event,
+	.report           = sony_report,
+	.probe            = sony_probe,
+	.remove           = sony_remove,
+#ifdef CONFIG_PM
+	.suspend          = sony_suspend,
+	.resume           = sony_resume,
+	.reset_resume     = sony_resume,
+#endif
+	.driver = {
+		.dev_groups = sony_groups,
+	},
+};
+
+#ifdef PRISMRIVER_USB_DIRECT
+
+/*
+ * Direct USB path, built with "make USB_DIRECT=1": the PS3 dongle is bound
+ * as a plain USB interface driver with its own interrupt URBs, and its
+ * fixed report is decoded straight into input events, without usbhid and
+ * the HID core. It only provides the input device; the event channel,
+ * debugfs and sysfs features live in the HID path, which remains the
+ * default. usbhid claims every HID interface, so the dongle has to be kept
+ * from it, e.g. with usbhid.quirks=0x12ba:0x0100:0x4 (HID_QUIRK_IGNORE).
+ */
+#define GUITAR_USB_URBS 2
+
+/* Axes of the report the frame does not carry, as hid-input maps them */
+#define GUITAR_USB_HAT_OFFSET	2
+#define GUITAR_USB_X_OFFSET	3
+#define GUITAR_USB_Y_OFFSET	4
+#define GUITAR_USB_RZ_OFFSET	6
+#define GUITAR_USB_HAT_NULL	8
+
+struct guitar_usb {
+	struct usb_device *udev;
+	struct usb_interface *intf;
+	struct input_dev *input;
+	struct usb_anchor anchor;
+	struct urb *urbs[GUITAR_USB_URBS];
+	struct prismriver_frame last;
+	u8 last_hat, last_x, last_y, last_rz;
+	/* Serializes open, close, suspend, resume and @retry */
+	struct mutex lock;
+	bool open;
+	bool suspended;
+	unsigned long stopped;		/* URBs waiting for @retry */
+	bool halted;
+	struct delayed_work retry;
+	char phys[64];
+};
+
+/* Same codes hid-input gives the dongle's joystick buttons 1-13 */
+static const struct {
+	u16 button;
+	u16 code;
+} guitar_usb_keys[] = {
+	{ PRISMRIVER_BTN_BLUE, BTN_TRIGGER },
+	{ PRISMRIVER_BTN_GREEN, BTN_THUMB },
+	{ PRISMRIVER_BTN_RED, BTN_THUMB2 },
+	{ PRISMRIVER_BTN_YELLOW, BTN_TOP },
+	{ PRISMRIVER_BTN_ORANGE, BTN_TOP2 },
+	{ PRISMRIVER_BTN_SELECT, BTN_BASE3 },
+	{ PRISMRIVER_BTN_START, BTN_BASE4 },
+	{ PRISMRIVER_BTN_PS, BTN_BASE6 + 1 },	/* 0x12c has no name */
+};
+
+/* hid-input's split of the 8 way hat, indexed by direction + 1 */
+static const struct {
+	s8 x;
+	s8 y;
+} guitar_usb_hat[] = {
+	{ 0, 0 }, { 0, -1 }, { 1, -1 }, { 1, 0 }, { 1, 1 },
+	{ 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 },
+};
+
+static void guitar_usb_report(struct guitar_usb *gu,
+			      const struct prismriver_frame *frame)
+{
+	struct input_dev *input = gu->input;
+	int hat = gu->last_hat < GUITAR_USB_HAT_NULL ? gu->last_hat + 1 : 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(guitar_usb_keys); i++)
+		input_report_key(input, guitar_usb_keys[i].code,
+				 frame->buttons & guitar_usb_keys[i].button);
+
+	input_report_abs(input, ABS_HAT0X, guitar_usb_hat[hat].x);
+	input_report_abs(input, ABS_HAT0Y, guitar_usb_hat[hat].y);
+	input_report_abs(input, ABS_X, gu->last_x);
+	input_report_abs(input, ABS_Y, gu->last_y);
+	input_report_abs(input, ABS_Z, frame->whammy);
+	input_report_abs(input, ABS_RZ, gu->last_rz);
+	input_report_abs(input, ABS_RY, frame->tilt);
+	input_sync(input);
+}
+
+/* Whether the axes the frame does not carry moved, updating them */
+static bool guitar_usb_axes_changed(struct guitar_usb *gu, const u8 *rd)
+{
+	bool changed = rd[GUITAR_USB_HAT_OFFSET] != gu->last_hat ||
+		       rd[GUITAR_USB_X_OFFSET] != gu->last_x ||
+		       rd[GUITAR_USB_Y_OFFSET] != gu->last_y ||
+		       rd[GUITAR_USB_RZ_OFFSET] != gu->last_rz;
+
+	gu->last_hat = rd[GUITAR_USB_HAT_OFFSET];
+	gu->last_x = rd[GUITAR_USB_X_OFFSET];
+	gu->last_y = rd[GUITAR_USB_Y_OFFSET];
+	gu->last_rz = rd[GUITAR_USB_RZ_OFFSET];
+
+	return changed;
+}
+
+static void guitar_usb_complete(struct urb *urb)
+{
+	struct guitar_usb *gu = urb->context;
+	struct prismriver_frame frame;
+	bool changed;
+	int i, ret;
+
+	switch (urb->status) {
+	case 0:
+		if (prismriver_decode(&prismriver_default_layout,
+				      urb->transfer_buffer, urb->actual_length,
+				      &frame))
+			break;
+		changed = guitar_usb_axes_changed(gu, urb->transfer_buffer);
+		if (prismriver_frame_changes(&gu->last, &frame) || changed) {
+			gu->last = frame;
+			guitar_usb_report(gu, &frame);
+		}
+		break;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+	case -EPERM:
+		return;
+	case -EPIPE:
+	case -EILSEQ:
+	case -EPROTO:
+	case -ETIME:
+	case -ETIMEDOUT:
+		/* As guitar_urb_complete(), rest the URB and clear stalls */
+		if (urb->status == -EPIPE)
+			WRITE_ONCE(gu->halted, true);
+		for (i = 0; i < GUITAR_USB_URBS; i++)
+			if (gu->urbs[i] == urb)
+				set_bit(i, &gu->stopped);
+		schedule_delayed_work(&gu->retry,
+				      msecs_to_jiffies(GUITAR_URB_RETRY_MS));
+		return;
+	default:
+		break;
+	}
+
+	usb_anchor_urb(urb, &gu->anchor);
+	ret = usb_submit_urb(urb, GFP_ATOMIC);
+	if (ret) {
+		usb_unanchor_urb(urb);
+		if (ret != -EPERM)
+			dev_err_ratelimited(&gu->intf->dev,
+					    "URB resubmit failed: %d\n", ret);
+	}
+}
+
+/* Called with gu->lock held */
+static int guitar_usb_submit(struct guitar_usb *gu)
+{
+	int i, ret;
+
+	/* All of them are idle here, the stopped ones included */
+	gu->stopped = 0;
+
+	for (i = 0; i < GUITAR_USB_URBS; i++) {
+		usb_anchor_urb(gu->urbs[i], &gu->anchor);
+		ret = usb_submit_urb(gu->urbs[i], GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(gu->urbs[i]);
+			usb_kill_anchored_urbs(&gu->anchor);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void guitar_usb_retry(struct work_struct *work)
+{
+	struct guitar_usb *gu = container_of(to_delayed_work(work),
+					     struct guitar_usb, retry);
+	int i, ret;
+
+	mutex_lock(&gu->lock);
+
+	if (!gu->open || gu->suspended)
+		goto out;
+
+	if (gu->halted) {
+		gu->halted = false;
+		ret = usb_clear_halt(gu->udev, gu->urbs[0]->pipe);
+		if (ret)
+			dev_warn(&gu->intf->dev, "clear halt failed: %d\n",
+				 ret);
+	}
+
+	for (i = 0; i < GUITAR_USB_URBS; i++) {
+		if (!test_and_clear_bit(i, &gu->stopped))
+			continue;
+		usb_anchor_urb(gu->urbs[i], &gu->anchor);
+		ret = usb_submit_urb(gu->urbs[i], GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(gu->urbs[i]);
+			dev_warn(&gu->intf->dev, "URB resubmit failed: %d\n",
+				 ret);
+		}
+	}
+
+out:
+	mutex_unlock(&gu->lock);
+}
+
+static int guitar_usb_open(struct input_dev *input)
+{
+	struct guitar_usb *gu = input_get_drvdata(input);
+	int ret = 0;
+
+	mutex_lock(&gu->lock);
+	if (!gu->suspended)
+		ret = guitar_usb_submit(gu);
+	if (!ret)
+		gu->open = true;
+	mutex_unlock(&gu->lock);
+
+	return ret;
+}
+
+static void guitar_usb_close(struct input_dev *input)
+{
+	struct guitar_usb *gu = input_get_drvdata(input);
+
+	mutex_lock(&gu->lock);
+	gu->open = false;
+	usb_kill_anchored_urbs(&gu->anchor);
+	mutex_unlock(&gu->lock);
+}
+
+static void guitar_usb_free_urbs(struct guitar_usb *gu)
+{
+	struct urb *urb;
+	int i;
+
+	for (i = 0; i < GUITAR_USB_URBS; i++) {
+		urb = gu->urbs[i];
+		if (!urb)
+			continue;
+		usb_free_coherent(gu->udev, urb->transfer_buffer_length,
+				  urb->transfer_buffer, urb->transfer_dma);
+		usb_free_urb(urb);
+	}
+}
+
+static int guitar_usb_probe(struct usb_interface *intf,
+			    const struct usb_device_id *id)
+{
+	struct usb_device *udev = interface_to_usbdev(intf);
+	struct usb_endpoint_descriptor *ep;
+	struct input_dev *input;
+	struct guitar_usb *gu;
+	unsigned int maxp;
+	void *buf;
+	int i, ret;
+
+	ret = usb_find_int_in_endpoint(intf->cur_altsetting, &ep);
+	if (ret)
+		return ret;
+
+	gu = devm_kzalloc(&intf->dev, sizeof(*gu), GFP_KERNEL);
+	if (!gu)
+		return -ENOMEM;
+
+	gu->udev = udev;
+	gu->intf = intf;
+	gu->last_hat = GUITAR_USB_HAT_NULL;
+	init_usb_anchor(&gu->anchor);
+	mutex_init(&gu->lock);
+	INIT_DELAYED_WORK(&gu->retry, guitar_usb_retry);
+
+	maxp = usb_endpoint_maxp(ep);
+	for (i = 0; i < GUITAR_USB_URBS; i++) {
+		gu->urbs[i] = usb_alloc_urb(0, GFP_KERNEL);
+		if (!gu->urbs[i]) {
+			ret = -ENOMEM;
+			goto err_free;
+		}
+
+		buf = usb_alloc_coherent(udev, maxp, GFP_KERNEL,
+					 &gu->urbs[i]->transfer_dma);
+		if (!buf) {
+			usb_free_urb(gu->urbs[i]);
+			gu->urbs[i] = NULL;
+			ret = -ENOMEM;
+			goto err_free;
+		}
+
+		usb_fill_int_urb(gu->urbs[i], udev,
+				 usb_rcvintpipe(udev, ep->bEndpointAddress),
+				 buf, maxp, guitar_usb_complete, gu,
+				 ep->bInterval);
+		gu->urbs[i]->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	input = devm_input_allocate_device(&intf->dev);
+	if (!input) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	gu->input = input;
+
+	usb_make_path(udev, gu->phys, sizeof(gu->phys));
+	strlcat(gu->phys, "/input0", sizeof(gu->phys));
+
+	input->name = "Guitar Hero PS3 Guitar (direct USB)";
+	input->phys = gu->phys;
+	usb_to_input_id(udev, &input->id);
+	input->dev.parent = &intf->dev;
+	input->open = guitar_usb_open;
+	input->close = guitar_usb_close;
+	input_set_drvdata(input, gu);
+
+	for (i = 0; i < ARRAY_SIZE(guitar_usb_keys); i++)
+		input_set_capability(input, EV_KEY, guitar_usb_keys[i].code);
+	input_set_abs_params(input, ABS_HAT0X, -1, 1, 0, 0);
+	input_set_abs_params(input, ABS_HAT0Y, -1, 1, 0, 0);
+	input_set_abs_params(input, ABS_X, 0, 255, 0, 0);
+	input_set_abs_params(input, ABS_Y, 0, 255, 0, 0);
+	input_set_abs_params(input, ABS_Z, 0, 255, 0, 0);
+	input_set_abs_params(input, ABS_RZ, 0, 255, 0, 0);
+	input_set_abs_params(input, ABS_RY, 0, 1023, 0, 0);
+
+	usb_set_intfdata(intf, gu);
+
+	ret = input_register_device(input);
+	if (ret)
+		goto err_free;
+
+	return 0;
+
+err_free:
+	guitar_usb_free_urbs(gu);
+	return ret;
+}
+
+static void guitar_usb_disconnect(struct usb_interface *intf)
+{
+	struct guitar_usb *gu = usb_get_intfdata(intf);
+
+	/* Closes the input device, which kills the URBs */
+	input_unregister_device(gu->input);
+	usb_kill_anchored_urbs(&gu->anchor);
+	cancel_delayed_work_sync(&gu->retry);
+	guitar_usb_free_urbs(gu);
+}
+
+static int guitar_usb_suspend(struct usb_interface *intf, pm_message_t message)
+{
+	struct guitar_usb *gu = usb_get_intfdata(intf);
+
+	mutex_lock(&gu->lock);
+	gu->suspended = true;
+	usb_kill_anchored_urbs(&gu->anchor);
+	mutex_unlock(&gu->lock);
+
+	return 0;
+}
+
+static int guitar_usb_resume(struct usb_interface *intf)
+{
+	struct guitar_usb *gu = usb_get_intfdata(intf);
+	int ret = 0;
+
+	mutex_lock(&gu->lock);
+	gu->suspended = false;
+	if (gu->open)
+		ret = guitar_usb_submit(gu);
+	mutex_unlock(&gu->lock);
+
+	return ret;
+}
+
+static const struct usb_device_id guitar_usb_devices[] = {
+	{ USB_DEVICE(USB_VENDOR_ID_SONY_RHYTHM, USB_DEVICE_ID_SONY_PS3_GUITAR_DONGLE) },
+	{ }
+};
+MODULE_DEVICE_TABLE(usb, guitar_usb_devices);
+
+static struct usb_driver guitar_usb_driver = {
+	.name		= "prismriver_usb",
+	.id_table	= guitar_usb_devices,
+	.probe		= guitar_usb_probe,
+	.disconnect	= guitar_usb_disconnect,
+	.suspend	= guitar_usb_suspend,
+	.resume		= guitar_usb_resume,
+	.reset_resume	= guitar_usb_resume,
+};
+
+#endif /* PRISMRIVER_USB_DIRECT */
+
+static int __init sony_init(void)
+{
+	int ret;
+
+	dbg_hid("Sony:%s\n", __func__);
+
+	prismriver_wq = alloc_ordered_workqueue("prismriver", 0);
+	if (!prismriver_wq)
+		return -ENOMEM;
+
+	prismriver_debugfs_root = debugfs_create_dir("prismriver", NULL);
+
+	ret = hid_register_driver(&sony_driver);
+	if (ret)
+		goto err_debugfs;
+
+#ifdef PRISMRIVER_USB_DIRECT
+	ret = usb_register(&guitar_usb_driver);
+	if (ret) {
+		hid_unregister_driver(&sony_driver);
+		goto err_debugfs;
+	}
+#endif
+
+	return 0;
+
+err_debugfs:
+	debugfs_remove_recursive(prismriver_debugfs_root);
+	destroy_workqueue(prismriver_wq);
+	return ret;
+}
+
+static void __exit sony_exit(void)
+{
+	dbg_hid("Sony:%s\n", __func__);
+
+	/* Pending rebinds may bind the guitars to this driver again */
+	destroy_workqueue(prismriver_wq);
+#ifdef PRISMRIVER_USB_DIRECT
+	usb_deregister(&guitar_usb_driver);
+#endif
+	hid_unregister_driver(&sony_driver);
+	ida_destroy(&sony_device_id_allocator);
+	debugfs_remove_recursive(prismriver_debugfs_root);
+}
+module_init(sony_init);
+module_exit(sony_exit);
+
+MODULE_DESCRIPTION("HID driver for Sony / PS2 / PS3 / PS4 BD devices");
+MODULE_LICENSE("GPL");
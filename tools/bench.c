@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Shared plumbing of the benchmarks, see bench.h.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include "bench.h"
+
+#define HID_DEVICES "/sys/bus/hid/devices"
+#define HID_DRIVERS "/sys/bus/hid/drivers"
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define test_bit(n, bits) ((bits)[(n) / BITS_PER_LONG] >> ((n) % BITS_PER_LONG) & 1)
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+	ssize_t n = write(fd, ev, sizeof(*ev));
+
+	if (n < 0)
+		return -errno;
+
+	return n == sizeof(*ev) ? 0 : -EIO;
+}
+
+/* Look for the HID device whose uevent has HID_UNIQ=@uniq */
+static int find_hid_id(const char *uniq, char *id, size_t size)
+{
+	char path[PATH_MAX], line[256], want[256];
+	struct dirent *de;
+	FILE *f;
+	DIR *dir;
+	int found = 0;
+
+	snprintf(want, sizeof(want), "HID_UNIQ=%s\n", uniq);
+
+	dir = opendir(HID_DEVICES);
+	if (!dir)
+		return -errno;
+
+	while (!found && (de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), HID_DEVICES "/%s/uevent",
+			 de->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		while (fgets(line, sizeof(line), f))
+			if (!strcmp(line, want) &&
+			    strlen(de->d_name) < size) {
+				strcpy(id, de->d_name);
+				found = 1;
+				break;
+			}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return found ? 0 : -ENOENT;
+}
+
+static int read_driver(const char *hid_id, char *driver, size_t size)
+{
+	char path[PATH_MAX], target[PATH_MAX];
+	const char *name;
+	ssize_t n;
+
+	snprintf(path, sizeof(path), HID_DEVICES "/%s/driver", hid_id);
+	n = readlink(path, target, sizeof(target) - 1);
+	if (n < 0)
+		return -errno;
+	target[n] = '\0';
+
+	name = strrchr(target, '/');
+	name = name ? name + 1 : target;
+	if (strlen(name) >= size)
+		return -ENAMETOOLONG;
+	strcpy(driver, name);
+
+	return 0;
+}
+
+/*
+ * The guitar's joystick node has the whammy on ABS_Z whichever driver is
+ * bound; prismriver's keyboard node, which stays silent until a profile
+ * is set, has no absolute axes at all.
+ */
+static int is_joystick(int fd)
+{
+	unsigned long abs[ABS_CNT / BITS_PER_LONG + 1] = { 0 };
+
+	if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs) < 0)
+		return 0;
+
+	return test_bit(ABS_Z, abs);
+}
+
+/* Open the guitar's joystick evdev node below the HID device */
+static int open_evdev(const char *hid_id)
+{
+	char path[PATH_MAX];
+	struct dirent *de, *ev;
+	DIR *inputs, *dir;
+	int clk = CLOCK_MONOTONIC;
+	int fd = -ENOENT;
+
+	snprintf(path, sizeof(path), HID_DEVICES "/%s/input", hid_id);
+	inputs = opendir(path);
+	if (!inputs)
+		return -errno;
+
+	while (fd < 0 && (de = readdir(inputs))) {
+		if (strncmp(de->d_name, "input", 5))
+			continue;
+
+		snprintf(path, sizeof(path), HID_DEVICES "/%s/input/%s",
+			 hid_id, de->d_name);
+		dir = opendir(path);
+		if (!dir)
+			continue;
+		while ((ev = readdir(dir)))
+			if (!strncmp(ev->d_name, "event", 5))
+				break;
+		if (ev) {
+			snprintf(path, sizeof(path), "/dev/input/%s",
+				 ev->d_name);
+			fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			if (fd < 0) {
+				fd = -errno;
+			} else if (!is_joystick(fd)) {
+				close(fd);
+				fd = -ENOENT;
+			} else if (ioctl(fd, EVIOCSCLOCKID, &clk) < 0) {
+				close(fd);
+				fd = -errno;
+			}
+		}
+		closedir(dir);
+	}
+	closedir(inputs);
+
+	return fd;
+}
+
+int simdev_create(struct simdev *dev, const struct cap *cap, const char *uniq,
+		  int timeout_ms)
+{
+	struct uhid_event ev;
+	uint64_t deadline;
+	int ret;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->evdev = -1;
+
+	if (cap->hdr.rdesc_size > sizeof(ev.u.create2.rd_data))
+		return -EINVAL;
+
+	dev->uhid = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (dev->uhid < 0)
+		return -errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name),
+		 "prismriver bench %s", uniq);
+	snprintf((char *)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s",
+		 uniq);
+	ev.u.create2.bus = cap->hdr.bus;
+	ev.u.create2.vendor = cap->hdr.vendor;
+	ev.u.create2.product = cap->hdr.product;
+	ev.u.create2.rd_size = cap->hdr.rdesc_size;
+	memcpy(ev.u.create2.rd_data, cap->rdesc, cap->hdr.rdesc_size);
+
+	ret = uhid_write(dev->uhid, &ev);
+	if (ret)
+		goto err;
+
+	/* Devices are added and bound asynchronously */
+	deadline = now_ns() + timeout_ms * 1000000ULL;
+	for (;;) {
+		simdev_drain(dev);
+
+		if ((dev->hid_id[0] ||
+		     !find_hid_id(uniq, dev->hid_id, sizeof(dev->hid_id))) &&
+		    !read_driver(dev->hid_id, dev->driver, sizeof(dev->driver))) {
+			dev->evdev = open_evdev(dev->hid_id);
+			if (dev->evdev >= 0)
+				return 0;
+		}
+
+		if (now_ns() > deadline) {
+			ret = -ETIMEDOUT;
+			goto err;
+		}
+		usleep(10000);
+	}
+
+err:
+	simdev_destroy(dev);
+	return ret;
+}
+
+static int write_sysfs(const char *path, const char *value)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	n = write(fd, value, strlen(value));
+	close(fd);
+
+	return n < 0 ? -errno : 0;
+}
+
+int simdev_bind(struct simdev *dev, const char *driver, int timeout_ms)
+{
+	char path[PATH_MAX];
+	uint64_t deadline;
+	int ret;
+
+	if (!strcmp(dev->driver, driver))
+		return 0;
+
+	close(dev->evdev);
+	dev->evdev = -1;
+
+	snprintf(path, sizeof(path), HID_DRIVERS "/%s/unbind", dev->driver);
+	ret = write_sysfs(path, dev->hid_id);
+	if (ret)
+		return ret;
+
+	snprintf(path, sizeof(path), HID_DRIVERS "/%s/bind", driver);
+	ret = write_sysfs(path, dev->hid_id);
+	if (ret)
+		return ret;
+
+	deadline = now_ns() + timeout_ms * 1000000ULL;
+	for (;;) {
+		simdev_drain(dev);
+
+		if (!read_driver(dev->hid_id, dev->driver, sizeof(dev->driver))) {
+			if (strcmp(dev->driver, driver))
+				return -EBUSY;
+			dev->evdev = open_evdev(dev->hid_id);
+			if (dev->evdev >= 0)
+				return 0;
+		}
+
+		if (now_ns() > deadline)
+			return -ETIMEDOUT;
+		usleep(10000);
+	}
+}
+
+void simdev_destroy(struct simdev *dev)
+{
+	struct uhid_event ev;
+
+	if (dev->evdev >= 0)
+		close(dev->evdev);
+	dev->evdev = -1;
+
+	if (dev->uhid >= 0) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_DESTROY;
+		uhid_write(dev->uhid, &ev);
+		close(dev->uhid);
+	}
+	dev->uhid = -1;
+}
+
+int simdev_input(struct simdev *dev, const uint8_t *report, uint16_t size)
+{
+	struct uhid_event ev;
+
+	if (size > sizeof(ev.u.input2.data))
+		return -EINVAL;
+
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = size;
+	memcpy(ev.u.input2.data, report, size);
+
+	return uhid_write(dev->uhid, &ev);
+}
+
+void simdev_drain(struct simdev *dev)
+{
+	struct uhid_event ev;
+
+	while (read(dev->uhid, &ev, sizeof(ev)) > 0)
+		;
+}
+
+size_t evdev_drain(int fd, struct lat *lat)
+{
+	struct input_event evs[64];
+	uint64_t now, t;
+	size_t total = 0;
+	ssize_t n;
+	int i;
+
+	while ((n = read(fd, evs, sizeof(evs))) > 0) {
+		now = now_ns();
+		n /= sizeof(evs[0]);
+		total += n;
+
+		if (!lat)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (evs[i].type != EV_SYN || evs[i].code != SYN_REPORT)
+				continue;
+			t = evs[i].input_event_sec * 1000000000ULL +
+			    evs[i].input_event_usec * 1000ULL;
+			lat_add(lat, now > t ? now - t : 0);
+		}
+	}
+
+	return total;
+}
+
+int lat_add(struct lat *lat, uint64_t ns)
+{
+	uint32_t *p;
+
+	if (lat->count == lat->capacity) {
+		size_t capacity = lat->capacity ? 2 * lat->capacity : 4096;
+
+		p = realloc(lat->ns, capacity * sizeof(*p));
+		if (!p)
+			return -ENOMEM;
+		lat->ns = p;
+		lat->capacity = capacity;
+	}
+
+	lat->ns[lat->count++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+	lat->sorted = 0;
+
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+uint64_t lat_percentile(struct lat *lat, double p)
+{
+	size_t i;
+
+	if (!lat->count)
+		return 0;
+
+	if (!lat->sorted) {
+		qsort(lat->ns, lat->count, sizeof(*lat->ns), cmp_u32);
+		lat->sorted = 1;
+	}
+
+	i = p / 100 * (lat->count - 1) + 0.5;
+
+	return lat->ns[i < lat->count ? i : lat->count - 1];
+}
+
+void lat_free(struct lat *lat)
+{
+	free(lat->ns);
+	memset(lat, 0, sizeof(*lat));
+}
+
+int cpu_irq_time(uint64_t *irq_ns, uint64_t *softirq_ns)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	long hz = sysconf(_SC_CLK_TCK);
+	FILE *f;
+	int n;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return -errno;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &sys, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+
+	if (n != 7)
+		return -EIO;
+
+	*irq_ns = irq * (1000000000ULL / hz);
+	*softirq_ns = softirq * (1000000000ULL / hz);
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  Shared plumbing of the benchmarks: simulated guitars created through
+ *  uhid from a capture file, their evdev nodes, and latency samples.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capfile.h"
+
+/* A simulated dongle, found in sysfs once a driver has bound to it */
+struct simdev {
+	int uhid;
+	int evdev;
+	char hid_id[32];		/* e.g. "0003:12BA:0100.0007" */
+	char driver[32];
+};
+
+/* Delivery latency samples, in nanoseconds */
+struct lat {
+	uint32_t *ns;
+	size_t count;
+	size_t capacity;
+	int sorted;
+};
+
+uint64_t now_ns(void);
+
+/*
+ * Create a device with the IDs and report descriptor of the capture and
+ * wait up to timeout_ms for a driver to bind and an evdev node to appear.
+ * @uniq must be unique among the devices alive at the same time. Returns
+ * 0 or a negative errno.
+ */
+int simdev_create(struct simdev *dev, const struct cap *cap, const char *uniq,
+		  int timeout_ms);
+void simdev_destroy(struct simdev *dev);
+
+/*
+ * Move the device over to @driver, e.g. "hid-generic", through its sysfs
+ * unbind and bind files, and wait up to timeout_ms for its evdev node.
+ * Returns 0 or a negative errno.
+ */
+int simdev_bind(struct simdev *dev, const char *driver, int timeout_ms);
+
+/* Feed one report through uhid, as if it came from the device */
+int simdev_input(struct simdev *dev, const uint8_t *report, uint16_t size);
+
+/* Read pending uhid events (start, open, output reports...) and drop them */
+void simdev_drain(struct simdev *dev);
+
+/*
+ * Read pending events from evdev, adding the delivery latency of every
+ * SYN_REPORT to @lat if it is not NULL. Returns the number of events read.
+ */
+size_t evdev_drain(int fd, struct lat *lat);
+
+int lat_add(struct lat *lat, uint64_t ns);
+/* @p in percent, e.g. 99.9 */
+uint64_t lat_percentile(struct lat *lat, double p);
+void lat_free(struct lat *lat);
+
+/* Total hardirq and softirq time of all CPUs so far, from /proc/stat */
+int cpu_irq_time(uint64_t *irq_ns, uint64_t *softirq_ns);
+
+#endif /* _BENCH_H */
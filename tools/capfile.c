@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Reading and writing prismriver capture files.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capfile.h"
+
+int cap_init(struct cap *cap, uint16_t bus, uint16_t vendor, uint16_t product,
+	     const uint8_t *rdesc, uint16_t rdesc_size, uint16_t report_size)
+{
+	memset(cap, 0, sizeof(*cap));
+
+	cap->hdr.magic = PRISMRIVER_CAP_MAGIC;
+	cap->hdr.version = PRISMRIVER_CAP_VERSION;
+	cap->hdr.header_size = sizeof(struct prismriver_cap_header);
+	cap->hdr.bus = bus;
+	cap->hdr.vendor = vendor;
+	cap->hdr.product = product;
+	cap->hdr.report_size = report_size;
+	cap->hdr.rdesc_size = rdesc_size;
+
+	cap->rdesc = malloc(rdesc_size ? rdesc_size : 1);
+	if (!cap->rdesc)
+		return -ENOMEM;
+	memcpy(cap->rdesc, rdesc, rdesc_size);
+
+	return 0;
+}
+
+int cap_append(struct cap *cap, uint64_t delta_ns, const uint8_t *report)
+{
+	size_t size = cap_record_size(cap);
+	uint32_t delta;
+	uint8_t *rec;
+
+	if (cap->hdr.count == cap->capacity) {
+		size_t capacity = cap->capacity ? 2 * cap->capacity : 4096;
+
+		rec = realloc(cap->records, capacity * size);
+		if (!rec)
+			return -ENOMEM;
+		cap->records = rec;
+		cap->capacity = capacity;
+	}
+
+	delta = htole32(delta_ns > UINT32_MAX ? UINT32_MAX : delta_ns);
+	rec = cap->records + cap->hdr.count++ * size;
+	memcpy(rec, &delta, sizeof(delta));
+	memcpy(rec + sizeof(delta), report, cap->hdr.report_size);
+
+	return 0;
+}
+
+static void header_to_le(struct prismriver_cap_header *hdr)
+{
+	hdr->magic = htole32(hdr->magic);
+	hdr->version = htole16(hdr->version);
+	hdr->header_size = htole16(hdr->header_size);
+	hdr->bus = htole16(hdr->bus);
+	hdr->vendor = htole16(hdr->vendor);
+	hdr->product = htole16(hdr->product);
+	hdr->report_size = htole16(hdr->report_size);
+	hdr->rdesc_size = htole16(hdr->rdesc_size);
+	hdr->count = htole32(hdr->count);
+}
+
+static void header_from_le(struct prismriver_cap_header *hdr)
+{
+	hdr->magic = le32toh(hdr->magic);
+	hdr->version = le16toh(hdr->version);
+	hdr->header_size = le16toh(hdr->header_size);
+	hdr->bus = le16toh(hdr->bus);
+	hdr->vendor = le16toh(hdr->vendor);
+	hdr->product = le16toh(hdr->product);
+	hdr->report_size = le16toh(hdr->report_size);
+	hdr->rdesc_size = le16toh(hdr->rdesc_size);
+	hdr->count = le32toh(hdr->count);
+}
+
+int cap_load(struct cap *cap, const char *path)
+{
+	FILE *f;
+	size_t size;
+	int ret = -EINVAL;
+
+	memset(cap, 0, sizeof(*cap));
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+
+	if (fread(&cap->hdr, sizeof(cap->hdr), 1, f) != 1)
+		goto out;
+	header_from_le(&cap->hdr);
+
+	if (cap->hdr.magic != PRISMRIVER_CAP_MAGIC ||
+	    cap->hdr.version != PRISMRIVER_CAP_VERSION ||
+	    cap->hdr.header_size < sizeof(cap->hdr) || !cap->hdr.report_size)
+		goto out;
+
+	if (fseek(f, cap->hdr.header_size, SEEK_SET))
+		goto out;
+
+	ret = -ENOMEM;
+	size = cap_record_size(cap) * cap->hdr.count;
+	cap->rdesc = malloc(cap->hdr.rdesc_size ? cap->hdr.rdesc_size : 1);
+	cap->records = malloc(size ? size : 1);
+	if (!cap->rdesc || !cap->records)
+		goto out;
+	cap->capacity = cap->hdr.count;
+
+	ret = -EINVAL;
+	if (fread(cap->rdesc, 1, cap->hdr.rdesc_size, f) != cap->hdr.rdesc_size ||
+	    fread(cap->records, 1, size, f) != size)
+		goto out;
+
+	ret = 0;
+out:
+	fclose(f);
+	if (ret)
+		cap_free(cap);
+
+	return ret;
+}
+
+int cap_save(const struct cap *cap, const char *path)
+{
+	struct prismriver_cap_header hdr = cap->hdr;
+	size_t size = cap_record_size(cap) * cap->hdr.count;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -errno;
+
+	header_to_le(&hdr);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(cap->rdesc, 1, cap->hdr.rdesc_size, f) != cap->hdr.rdesc_size ||
+	    fwrite(cap->records, 1, size, f) != size)
+		ret = -EIO;
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
+void cap_free(struct cap *cap)
+{
+	free(cap->rdesc);
+	free(cap->records);
+	memset(cap, 0, sizeof(*cap));
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  In-memory form of prismriver capture files (struct prismriver_cap_header
+ *  in prismriver.h). Records are kept in their on-disk layout.
+ */
+
+#ifndef _CAPFILE_H
+#define _CAPFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <endian.h>
+#include <string.h>
+
+#include "prismriver.h"
+
+struct cap {
+	struct prismriver_cap_header hdr;	/* host byte order */
+	uint8_t *rdesc;
+	uint8_t *records;
+	size_t capacity;
+};
+
+static inline size_t cap_record_size(const struct cap *cap)
+{
+	return sizeof(uint32_t) + cap->hdr.report_size;
+}
+
+static inline const uint8_t *cap_record(const struct cap *cap, uint32_t i)
+{
+	return cap->records + i * cap_record_size(cap);
+}
+
+static inline uint32_t cap_delta_ns(const struct cap *cap, uint32_t i)
+{
+	uint32_t delta;
+
+	memcpy(&delta, cap_record(cap, i), sizeof(delta));
+
+	return le32toh(delta);
+}
+
+static inline const uint8_t *cap_report(const struct cap *cap, uint32_t i)
+{
+	return cap_record(cap, i) + sizeof(uint32_t);
+}
+
+/* All of these return 0 or a negative errno */
+int cap_init(struct cap *cap, uint16_t bus, uint16_t vendor, uint16_t product,
+	     const uint8_t *rdesc, uint16_t rdesc_size, uint16_t report_size);
+int cap_append(struct cap *cap, uint64_t delta_ns, const uint8_t *report);
+int cap_load(struct cap *cap, const char *path);
+int cap_save(const struct cap *cap, const char *path);
+void cap_free(struct cap *cap);
+
+#endif /* _CAPFILE_H */
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  libprismriver, see libprismriver.h.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libprismriver.h"
+
+/* Read a batch of events at a time when rearming wakeups */
+#define DRAIN_BATCH 32
+#define CLOCK_SAMPLES 8
+
+int prismriver_open(struct prismriver *pr, const char *path)
+{
+	void *ring;
+	int ret;
+
+	memset(pr, 0, sizeof(*pr));
+	pr->mask = PRISMRIVER_EV_MASK_ALL;
+
+	pr->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (pr->fd < 0)
+		return -errno;
+
+	ring = mmap(NULL, PRISMRIVER_RING_MMAP_SIZE, PROT_READ, MAP_SHARED,
+		    pr->fd, 0);
+	if (ring == MAP_FAILED) {
+		ret = -errno;
+		close(pr->fd);
+		pr->fd = -1;
+		return ret;
+	}
+	pr->ring = ring;
+
+	/* Start with the events published from now on */
+	pr->tail = __atomic_load_n(&pr->ring->head, __ATOMIC_ACQUIRE);
+
+	return 0;
+}
+
+int prismriver_open_index(struct prismriver *pr, int index)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/dev/prismriver%d", index);
+
+	return prismriver_open(pr, path);
+}
+
+void prismriver_close(struct prismriver *pr)
+{
+	if (pr->ring)
+		munmap((void *)pr->ring, PRISMRIVER_RING_MMAP_SIZE);
+	if (pr->fd >= 0)
+		close(pr->fd);
+	pr->ring = NULL;
+	pr->fd = -1;
+}
+
+int prismriver_set_mask(struct prismriver *pr, uint32_t mask)
+{
+	if (ioctl(pr->fd, PRISMRIVER_IOC_SET_MASK, &mask) < 0)
+		return -errno;
+	pr->mask = mask;
+
+	return 0;
+}
+
+int prismriver_set_coalesce(struct prismriver *pr, uint32_t usecs,
+			    uint32_t frames)
+{
+	struct prismriver_coalesce c = {
+		.usecs = usecs,
+		.frames = frames,
+	};
+
+	return ioctl(pr->fd, PRISMRIVER_IOC_SET_COALESCE, &c) < 0 ? -errno : 0;
+}
+
+int prismriver_set_keymap(struct prismriver *pr,
+			  const struct prismriver_keymap *keymap)
+{
+	return ioctl(pr->fd, PRISMRIVER_IOC_SET_KEYMAP, keymap) < 0 ? -errno : 0;
+}
+
+int prismriver_busy_poll(const struct prismriver *pr)
+{
+	return !!(__atomic_load_n(&pr->ring->flags, __ATOMIC_RELAXED) &
+		  PRISMRIVER_RING_BUSY_POLL);
+}
+
+/*
+ * The driver writes event i into slot i % size, then publishes head i + 1
+ * with release semantics. Slot i is therefore rewritten while head is
+ * i + size, and a copy of event i is good if head was still below that
+ * after the copy.
+ */
+int prismriver_consume(struct prismriver *pr, struct prismriver_event *evs,
+		       unsigned int max)
+{
+	const uint32_t size = pr->ring->size;
+	uint32_t head, i, n, torn, kept;
+
+	head = __atomic_load_n(&pr->ring->head, __ATOMIC_ACQUIRE);
+	if (head - pr->tail > size) {
+		pr->lost += head - size - pr->tail;
+		pr->tail = head - size;
+	}
+
+	n = head - pr->tail;
+	if (n > max)
+		n = max;
+
+	for (i = 0; i < n; i++)
+		evs[i] = pr->ring->events[(pr->tail + i) % size];
+
+	/* Order the copies before the second load of head */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&pr->ring->head, __ATOMIC_RELAXED);
+
+	/* Copies of events the driver may have started to overwrite */
+	torn = 0;
+	if (head - pr->tail >= size)
+		torn = head - pr->tail - size + 1;
+	if (torn > n) {
+		pr->lost += torn;
+		pr->tail += torn;
+		return 0;
+	}
+
+	kept = 0;
+	for (i = torn; i < n; i++)
+		if (pr->mask & PRISMRIVER_EV_MASK(evs[i].type))
+			evs[kept++] = evs[i];
+
+	pr->lost += torn;
+	pr->tail += n;
+
+	return kept;
+}
+
+/*
+ * Wakeups are armed per open file by read(): discard what read() returns,
+ * the events themselves come from the ring.
+ */
+static void rearm(struct prismriver *pr)
+{
+	struct prismriver_event scratch[DRAIN_BATCH];
+
+	while (read(pr->fd, scratch, sizeof(scratch)) > 0)
+		;
+}
+
+int prismriver_wait(struct prismriver *pr, struct prismriver_event *evs,
+		    unsigned int max, int timeout_ms)
+{
+	struct pollfd pfd = {
+		.fd = pr->fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	ret = prismriver_consume(pr, evs, max);
+	if (ret)
+		return ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0)
+		return -errno;
+	if (pfd.revents & (POLLHUP | POLLERR))
+		return -ENODEV;
+	if (pfd.revents & POLLIN)
+		rearm(pr);
+
+	return prismriver_consume(pr, evs, max);
+}
+
+int prismriver_sample(const struct prismriver *pr,
+		      struct prismriver_frame *frame, uint64_t *time_ns)
+{
+	const uint32_t size = pr->ring->size;
+	struct prismriver_event ev;
+	uint32_t head, i;
+
+	head = __atomic_load_n(&pr->ring->head, __ATOMIC_ACQUIRE);
+
+	for (i = head; i != head - size && i; i--) {
+		ev = pr->ring->events[(i - 1) % size];
+		if (ev.type != PRISMRIVER_EV_FRAME)
+			continue;
+
+		/* Same check as prismriver_consume() for event i - 1 */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&pr->ring->head, __ATOMIC_RELAXED) -
+		    (i - 1) >= size)
+			return -EAGAIN;
+
+		*frame = ev.frame;
+		if (time_ns)
+			*time_ns = ev.time_ns;
+		return 0;
+	}
+
+	return -EAGAIN;
+}
+
+uint64_t prismriver_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Read the other clock between two reads of CLOCK_MONOTONIC and keep the
+ * tightest of a few samples, taking its midpoint.
+ */
+int prismriver_clock_init(struct prismriver_clock *c, clockid_t clock)
+{
+	uint64_t before, other, after, best = UINT64_MAX;
+	struct timespec ts;
+	int i;
+
+	if (clock_gettime(clock, &ts))
+		return -errno;
+
+	c->clock = clock;
+	for (i = 0; i < CLOCK_SAMPLES; i++) {
+		before = prismriver_now_ns();
+		other = clock_ns(clock);
+		after = prismriver_now_ns();
+
+		if (after - before >= best)
+			continue;
+		best = after - before;
+		c->offset_ns = other - (before + (after - before) / 2);
+	}
+
+	return 0;
+}
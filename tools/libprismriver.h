@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  libprismriver: client library for the event channel of the prismriver
+ *  guitar driver, /dev/prismriverN.
+ *
+ *  Wraps the memory ordering of the shared event ring so that consumers
+ *  read it without syscalls and without torn events, samples the current
+ *  guitar state from it, sets the per-consumer ioctls, and converts event
+ *  times from CLOCK_MONOTONIC to other clocks.
+ *
+ *  All functions returning int return 0 or a count on success and a
+ *  negative errno on failure. A struct prismriver is not thread safe.
+ */
+
+#ifndef _LIBPRISMRIVER_H
+#define _LIBPRISMRIVER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "prismriver.h"
+
+struct prismriver {
+	int fd;
+	const struct prismriver_ring *ring;
+	uint32_t tail;		/* next ring position to consume */
+	uint32_t mask;		/* PRISMRIVER_EV_MASK() bits */
+	uint64_t lost;		/* events overwritten before consumed */
+};
+
+int prismriver_open(struct prismriver *pr, const char *path);
+/* Opens /dev/prismriver<index> */
+int prismriver_open_index(struct prismriver *pr, int index);
+void prismriver_close(struct prismriver *pr);
+
+/*
+ * Subscription mask, applied by the driver to read() and wakeups and by
+ * the library to ring consumption.
+ */
+int prismriver_set_mask(struct prismriver *pr, uint32_t mask);
+int prismriver_set_coalesce(struct prismriver *pr, uint32_t usecs,
+			    uint32_t frames);
+int prismriver_busy_poll(const struct prismriver *pr);
+
+/* Keyboard translation profile of the guitar, see struct prismriver_keymap */
+int prismriver_set_keymap(struct prismriver *pr,
+			  const struct prismriver_keymap *keymap);
+
+/*
+ * Copy up to @max new events of the subscribed types out of the shared
+ * ring, oldest first, without any syscall. Returns the number of events
+ * copied. Events overwritten by the driver before they could be copied
+ * are skipped and counted in pr->lost.
+ */
+int prismriver_consume(struct prismriver *pr, struct prismriver_event *evs,
+		       unsigned int max);
+
+/*
+ * Wait up to @timeout_ms (-1 forever) until the driver signals new events,
+ * then consume them like prismriver_consume(). Use this rather than
+ * spinning on prismriver_consume() unless the busy_poll attribute of the
+ * guitar is set, in which case the driver signals nothing. May return 0
+ * before the timeout, on a wakeup for events already consumed.
+ */
+int prismriver_wait(struct prismriver *pr, struct prismriver_event *evs,
+		    unsigned int max, int timeout_ms);
+
+/*
+ * Latest guitar state: the most recent frame event still in the ring.
+ * Returns -EAGAIN if there is none.
+ */
+int prismriver_sample(const struct prismriver *pr,
+		      struct prismriver_frame *frame, uint64_t *time_ns);
+
+/* Conversion of event times to another clock, e.g. CLOCK_REALTIME */
+struct prismriver_clock {
+	clockid_t clock;
+	int64_t offset_ns;	/* clock - CLOCK_MONOTONIC */
+};
+
+/*
+ * Measure the offset of @clock from CLOCK_MONOTONIC. Clocks that can be
+ * stepped, like CLOCK_REALTIME, need this to be redone from time to time.
+ */
+int prismriver_clock_init(struct prismriver_clock *c, clockid_t clock);
+
+static inline uint64_t prismriver_clock_convert(const struct prismriver_clock *c,
+						uint64_t time_ns)
+{
+	return time_ns + c->offset_ns;
+}
+
+static inline struct timespec prismriver_ns_to_timespec(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	return ts;
+}
+
+/* Current CLOCK_MONOTONIC time, to compare with event times */
+uint64_t prismriver_now_ns(void);
+
+#endif /* _LIBPRISMRIVER_H */
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Compare drivers side by side on the same simulated dongle.
+ *
+ *  Usage: prismriver-ab [-l loops] [-F] <capture> <label>=<module>...
+ *
+ *  e.g.
+ *
+ *	prismriver-ab guitar.prcap prismriver=../driver/prismriver_driver.ko \
+ *		hid-sony=hid_sony hid-generic=
+ *
+ *  For each candidate in turn, the modules of all candidates are unloaded,
+ *  the candidate's own is loaded (insmod for a .ko path, modprobe for a
+ *  module name, nothing for an empty one), and a dongle with the capture's
+ *  IDs and report descriptor is created through uhid. An empty candidate
+ *  stands for hid-generic: should udev have autoloaded some other driver
+ *  for the dongle, the device is moved over to hid-generic through sysfs,
+ *  and the candidate fails if hid-generic will not take it. The capture
+ *  is then replayed into it -l times, at its recorded offsets or back to
+ *  back with -F, and the results of all candidates are printed together:
+ *
+ *    - the driver the device bound to
+ *    - per-report cost: uhid feeds each report to the HID core from
+ *      within write(), so the time of that write() is the cost of the
+ *      whole kernel path, driver included, up to the evdev queue
+ *    - evdev events and SYN_REPORT frames delivered
+ *    - end-to-end latency: from the start of the write() of a report to
+ *      reading the frame it produced from evdev
+ *
+ *  Upstream hid-sony and prismriver both register as "sony", which is
+ *  why candidates are loaded one at a time. Needs root and uhid.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define MAX_CANDIDATES 8
+#define BIND_TIMEOUT_MS 5000
+#define GENERIC_DRIVER "hid-generic"
+
+struct candidate {
+	const char *label;
+	const char *module;	/* .ko path, module name or "" */
+	char name[64];		/* as listed in /proc/modules */
+};
+
+struct result {
+	char driver[32];
+	uint64_t reports;
+	uint64_t events;
+	struct lat cost;
+	struct lat e2e;
+};
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+
+	return n >= m && !strcmp(s + n - m, suffix);
+}
+
+/* "../driver/prismriver_driver.ko" and "hid-sony" to their module names */
+static void module_name(struct candidate *c)
+{
+	const char *base = strrchr(c->module, '/');
+	char *p;
+
+	snprintf(c->name, sizeof(c->name), "%s", base ? base + 1 : c->module);
+	if (has_suffix(c->name, ".ko"))
+		c->name[strlen(c->name) - 3] = '\0';
+	for (p = c->name; *p; p++)
+		if (*p == '-')
+			*p = '_';
+}
+
+static int module_loaded(const char *name)
+{
+	char line[256];
+	size_t n = strlen(name);
+	int found = 0;
+	FILE *f;
+
+	f = fopen("/proc/modules", "r");
+	if (!f)
+		return 0;
+	while (!found && fgets(line, sizeof(line), f))
+		found = !strncmp(line, name, n) && line[n] == ' ';
+	fclose(f);
+
+	return found;
+}
+
+static int run_cmd(const char *fmt, const char *arg)
+{
+	char cmd[PATH_MAX + 32];
+
+	snprintf(cmd, sizeof(cmd), fmt, arg);
+
+	return system(cmd) ? -EIO : 0;
+}
+
+static int select_candidate(struct candidate *cands, int n, int sel)
+{
+	struct candidate *c = &cands[sel];
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (cands[i].name[0] && module_loaded(cands[i].name) &&
+		    run_cmd("rmmod %s", cands[i].name))
+			return -EBUSY;
+
+	if (!c->module[0])
+		return 0;
+	if (has_suffix(c->module, ".ko"))
+		return run_cmd("insmod %s", c->module);
+
+	return run_cmd("modprobe %s", c->module);
+}
+
+static int replay(const struct candidate *c, const struct cap *cap, int loops,
+		  int fast, struct result *res)
+{
+	struct simdev dev;
+	uint64_t next, start;
+	char driver[32];
+	size_t frames;
+	uint32_t i;
+	int ret;
+
+	ret = simdev_create(&dev, cap, "ab", BIND_TIMEOUT_MS);
+	if (ret)
+		return ret;
+
+	if (!c->module[0]) {
+		snprintf(driver, sizeof(driver), "%s", dev.driver);
+		ret = simdev_bind(&dev, GENERIC_DRIVER, BIND_TIMEOUT_MS);
+		if (ret) {
+			fprintf(stderr, "%s: bound to %s, which "
+				GENERIC_DRIVER " could not take over\n",
+				c->label, driver);
+			goto out;
+		}
+	}
+	snprintf(res->driver, sizeof(res->driver), "%s", dev.driver);
+	evdev_drain(dev.evdev, NULL);
+
+	next = now_ns();
+	while (loops--) {
+		for (i = 0; i < cap->hdr.count; i++) {
+			if (!fast) {
+				if (i)
+					next += cap_delta_ns(cap, i);
+				sleep_until(next);
+			}
+
+			start = now_ns();
+			ret = simdev_input(&dev, cap_report(cap, i),
+					   cap->hdr.report_size);
+			if (ret)
+				goto out;
+			lat_add(&res->cost, now_ns() - start);
+			res->reports++;
+
+			/* Events are queued by the time write() returns */
+			frames = res->e2e.count;
+			res->events += evdev_drain(dev.evdev, &res->e2e);
+			for (; frames < res->e2e.count; frames++)
+				res->e2e.ns[frames] = now_ns() - start;
+
+			simdev_drain(&dev);
+		}
+		next = now_ns();
+	}
+
+out:
+	simdev_destroy(&dev);
+
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: prismriver-ab [-l loops] [-F] <capture> <label>=<module>...\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct candidate cands[MAX_CANDIDATES];
+	struct result res[MAX_CANDIDATES];
+	int loops = 1, fast = 0;
+	int opt, i, n, ret;
+	struct cap cap;
+	char *eq;
+
+	while ((opt = getopt(argc, argv, "l:F")) != -1) {
+		switch (opt) {
+		case 'l':
+			loops = atoi(optarg);
+			if (loops < 1)
+				usage();
+			break;
+		case 'F':
+			fast = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	n = argc - optind - 1;
+	if (n < 1 || n > MAX_CANDIDATES)
+		usage();
+
+	memset(cands, 0, sizeof(cands));
+	for (i = 0; i < n; i++) {
+		eq = strchr(argv[optind + 1 + i], '=');
+		if (!eq)
+			usage();
+		*eq = '\0';
+		cands[i].label = argv[optind + 1 + i];
+		cands[i].module = eq + 1;
+		if (cands[i].module[0])
+			module_name(&cands[i]);
+	}
+
+	ret = cap_load(&cap, argv[optind]);
+	if (!ret && !cap.hdr.count)
+		ret = -EINVAL;
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	memset(res, 0, sizeof(res));
+	for (i = 0; i < n; i++) {
+		ret = select_candidate(cands, n, i);
+		if (!ret)
+			ret = replay(&cands[i], &cap, loops, fast, &res[i]);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", cands[i].label,
+				strerror(-ret));
+			return 1;
+		}
+	}
+
+	printf("%-14s %-12s %9s %9s %9s %10s %10s %10s %10s\n", "candidate",
+	       "driver", "reports", "events", "frames", "cost p50",
+	       "cost p99", "e2e p50", "e2e p99");
+	for (i = 0; i < n; i++) {
+		printf("%-14s %-12s %9llu %9llu %9zu %8.1fus %8.1fus %8.1fus %8.1fus\n",
+		       cands[i].label, res[i].driver,
+		       (unsigned long long)res[i].reports,
+		       (unsigned long long)res[i].events, res[i].e2e.count,
+		       lat_percentile(&res[i].cost, 50) / 1000.0,
+		       lat_percentile(&res[i].cost, 99) / 1000.0,
+		       lat_percentile(&res[i].e2e, 50) / 1000.0,
+		       lat_percentile(&res[i].e2e, 99) / 1000.0);
+		lat_free(&res[i].cost);
+		lat_free(&res[i].e2e);
+	}
+
+	cap_free(&cap);
+
+	return 0;
+}
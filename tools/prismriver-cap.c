@@ -0,0 +1,337 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Convert to and from prismriver capture files.
+ *
+ *  prismriver-cap import <hid-recorder output> <capture>
+ *	Convert the first device of a hid-recorder (hid-tools) log.
+ *
+ *  prismriver-cap export <hid device> <capture> <file>...
+ *	Build a capture from what the driver recorded: flight_recorder
+ *	dumps and the per-CPU files written by prismriver-capture. The
+ *	hid device, e.g. 0003:12BA:0100.0001, supplies the ids and the
+ *	report descriptor from sysfs.
+ *
+ *  prismriver-cap dump <capture>
+ *	Print a capture in hid-recorder's text format.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capfile.h"
+
+#define MAX_LINE 16384
+#define MAX_RDESC 4096
+
+static int parse_hex_bytes(char *s, uint8_t *out, int max)
+{
+	char *tok, *end;
+	int n = 0;
+
+	for (tok = strtok(s, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+		if (n == max)
+			return -1;
+		out[n++] = strtoul(tok, &end, 16);
+		if (*end)
+			return -1;
+	}
+
+	return n;
+}
+
+static int cmd_import(const char *in, const char *out)
+{
+	static uint8_t rdesc[MAX_RDESC], report[MAX_RDESC];
+	static char line[MAX_LINE];
+	unsigned int bus = 0, vendor = 0, product = 0, len;
+	unsigned long sec, usec;
+	uint64_t time_ns, prev_ns = 0;
+	int rdesc_size = -1, device = 0, n, ret;
+	struct cap cap = { 0 };
+	char *rest;
+	FILE *f;
+
+	f = fopen(in, "r");
+	if (!f) {
+		perror(in);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		/* Only the first device of multi-device recordings */
+		if (!strncmp(line, "D: ", 3)) {
+			device = atoi(line + 3);
+			continue;
+		}
+		if (device)
+			continue;
+
+		if (!strncmp(line, "R: ", 3)) {
+			strtoul(line + 3, &rest, 10);
+			rdesc_size = parse_hex_bytes(rest, rdesc, sizeof(rdesc));
+		} else if (!strncmp(line, "I: ", 3)) {
+			sscanf(line + 3, "%x %x %x", &bus, &vendor, &product);
+		} else if (!strncmp(line, "E: ", 3)) {
+			if (sscanf(line + 3, "%lu.%lu %u%n", &sec, &usec, &len, &n) != 3)
+				goto bad;
+			if (parse_hex_bytes(line + 3 + n, report, sizeof(report)) != (int)len)
+				goto bad;
+
+			if (!cap.rdesc) {
+				if (rdesc_size < 0) {
+					fprintf(stderr, "%s: events before the report descriptor\n", in);
+					goto err;
+				}
+				ret = cap_init(&cap, bus, vendor, product, rdesc,
+					       rdesc_size, len);
+				if (ret)
+					goto err;
+			}
+
+			if (len != cap.hdr.report_size) {
+				fprintf(stderr, "%s: report of %u bytes in a capture of %u byte reports\n",
+					in, len, cap.hdr.report_size);
+				goto err;
+			}
+
+			time_ns = (sec * 1000000ULL + usec) * 1000;
+			ret = cap_append(&cap, cap.hdr.count ? time_ns - prev_ns : 0,
+					 report);
+			if (ret)
+				goto err;
+			prev_ns = time_ns;
+		}
+	}
+	fclose(f);
+
+	if (!cap.rdesc) {
+		fprintf(stderr, "%s: no events\n", in);
+		return 1;
+	}
+
+	ret = cap_save(&cap, out);
+	if (ret)
+		fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+	else
+		printf("%u reports of %u bytes\n", cap.hdr.count, cap.hdr.report_size);
+	cap_free(&cap);
+
+	return !!ret;
+
+bad:
+	fprintf(stderr, "%s: malformed event: %s", in, line);
+err:
+	fclose(f);
+	cap_free(&cap);
+	return 1;
+}
+
+struct raw_set {
+	struct prismriver_raw_record *recs;
+	size_t count;
+	size_t capacity;
+};
+
+static int raw_set_add(struct raw_set *set, const struct prismriver_raw_record *r)
+{
+	if (set->count == set->capacity) {
+		size_t capacity = set->capacity ? 2 * set->capacity : 4096;
+		void *recs = realloc(set->recs, capacity * sizeof(*r));
+
+		if (!recs)
+			return -ENOMEM;
+		set->recs = recs;
+		set->capacity = capacity;
+	}
+	set->recs[set->count++] = *r;
+
+	return 0;
+}
+
+/* A flight_recorder dump or a plain array of records from prismriver-capture */
+static int read_raw_file(struct raw_set *set, const char *path)
+{
+	struct prismriver_recorder_header hdr;
+	struct prismriver_raw_record r;
+	int ret = 0;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+	    hdr.magic == PRISMRIVER_RECORDER_MAGIC) {
+		if (hdr.version != PRISMRIVER_RECORDER_VERSION ||
+		    hdr.record_size != sizeof(r)) {
+			fclose(f);
+			return -EINVAL;
+		}
+	} else {
+		rewind(f);
+	}
+
+	while (!ret && fread(&r, sizeof(r), 1, f) == 1)
+		ret = raw_set_add(set, &r);
+
+	fclose(f);
+
+	return ret;
+}
+
+static int compare_raw(const void *a, const void *b)
+{
+	const struct prismriver_raw_record *ra = a, *rb = b;
+
+	if (ra->time_ns != rb->time_ns)
+		return ra->time_ns < rb->time_ns ? -1 : 1;
+
+	return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+static int read_rdesc(const char *hid, uint8_t *rdesc)
+{
+	char path[512];
+	FILE *f;
+	int n;
+
+	snprintf(path, sizeof(path), "/sys/bus/hid/devices/%s/report_descriptor", hid);
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+	n = fread(rdesc, 1, MAX_RDESC, f);
+	fclose(f);
+
+	return n;
+}
+
+static int cmd_export(const char *hid, const char *out, char **files, int nr)
+{
+	static uint8_t rdesc[MAX_RDESC];
+	struct raw_set set = { 0 };
+	struct cap cap = { 0 };
+	unsigned int bus, vendor, product;
+	uint64_t prev_ns = 0;
+	size_t i, skipped = 0;
+	int rdesc_size, ret, f;
+
+	if (sscanf(hid, "%x:%x:%x", &bus, &vendor, &product) != 3) {
+		fprintf(stderr, "%s: not a hid device name\n", hid);
+		return 1;
+	}
+
+	rdesc_size = read_rdesc(hid, rdesc);
+	if (rdesc_size < 0) {
+		fprintf(stderr, "%s: cannot read report descriptor: %s\n", hid,
+			strerror(-rdesc_size));
+		return 1;
+	}
+
+	for (f = 0; f < nr; f++) {
+		ret = read_raw_file(&set, files[f]);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", files[f], strerror(-ret));
+			goto out;
+		}
+	}
+
+	if (!set.count) {
+		fprintf(stderr, "no records\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	qsort(set.recs, set.count, sizeof(*set.recs), compare_raw);
+
+	ret = cap_init(&cap, bus, vendor, product, rdesc, rdesc_size,
+		       set.recs[0].size);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < set.count && !ret; i++) {
+		const struct prismriver_raw_record *r = &set.recs[i];
+
+		/* The flight recorder and the capture channel overlap */
+		if (i && r->seq == set.recs[i - 1].seq &&
+		    r->time_ns == set.recs[i - 1].time_ns)
+			continue;
+
+		if (r->size != cap.hdr.report_size || r->size > PRISMRIVER_RAW_MAX) {
+			skipped++;
+			continue;
+		}
+
+		ret = cap_append(&cap, cap.hdr.count ? r->time_ns - prev_ns : 0,
+				 r->data);
+		prev_ns = r->time_ns;
+	}
+
+	if (!ret)
+		ret = cap_save(&cap, out);
+	if (!ret)
+		printf("%u reports of %u bytes, %zu of other sizes skipped\n",
+		       cap.hdr.count, cap.hdr.report_size, skipped);
+out:
+	if (ret)
+		fprintf(stderr, "export failed: %s\n", strerror(-ret));
+	cap_free(&cap);
+	free(set.recs);
+
+	return !!ret;
+}
+
+static int cmd_dump(const char *path)
+{
+	struct cap cap;
+	uint64_t time_ns = 0;
+	uint32_t i, j;
+	int ret;
+
+	ret = cap_load(&cap, path);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return 1;
+	}
+
+	printf("I: %x %04x %04x\n", cap.hdr.bus, cap.hdr.vendor, cap.hdr.product);
+	printf("R: %u", cap.hdr.rdesc_size);
+	for (i = 0; i < cap.hdr.rdesc_size; i++)
+		printf(" %02x", cap.rdesc[i]);
+	printf("\n");
+
+	for (i = 0; i < cap.hdr.count; i++) {
+		time_ns += cap_delta_ns(&cap, i);
+		printf("E: %06llu.%06llu %u", (unsigned long long)(time_ns / 1000000000),
+		       (unsigned long long)(time_ns / 1000 % 1000000), cap.hdr.report_size);
+		for (j = 0; j < cap.hdr.report_size; j++)
+			printf(" %02x", cap_report(&cap, i)[j]);
+		printf("\n");
+	}
+
+	cap_free(&cap);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s import <hid-recorder output> <capture>\n"
+		"       %s export <hid device> <capture> <file>...\n"
+		"       %s dump <capture>\n", prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 4 && !strcmp(argv[1], "import"))
+		return cmd_import(argv[2], argv[3]);
+	if (argc >= 5 && !strcmp(argv[1], "export"))
+		return cmd_export(argv[2], argv[3], argv + 4, argc - 4);
+	if (argc == 3 && !strcmp(argv[1], "dump"))
+		return cmd_dump(argv[2]);
+
+	usage(argv[0]);
+	return 2;
+}
@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Drain the relay capture channel of a guitar to disk.
+ *
+ *  Usage: prismriver-capture <debugfs device dir> <output prefix>
+ *
+ *  Opens the capture channel of the guitar, e.g.
+ *  /sys/kernel/debug/prismriver/0003:12BA:0100.0001, and copies the
+ *  stream of every CPU to <output prefix>.<cpu> until interrupted. Each
+ *  output file is a plain array of struct prismriver_raw_record;
+ *  "prismriver-cap export" merges them into one capture file.
+ *
+ *  Data is moved with splice() where the kernel supports it on relay
+ *  files, and with read()/write() otherwise.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prismriver.h"
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_CPUS 1024
+
+struct stream {
+	int in;
+	int out;
+	int pipe[2];
+	int use_splice;
+	unsigned long long bytes;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int write_ctl(const char *dir, const char *value)
+{
+	char path[PATH_MAX];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/capture", dir);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = write(fd, value, strlen(value)) < 0 ? -errno : 0;
+	close(fd);
+
+	return ret;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static ssize_t drain_splice(struct stream *s)
+{
+	ssize_t in, out, total = 0;
+
+	in = splice(s->in, NULL, s->pipe[1], NULL, CHUNK_SIZE,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (in <= 0)
+		return in < 0 && errno == EAGAIN ? 0 : in;
+
+	while (total < in) {
+		out = splice(s->pipe[0], NULL, s->out, NULL, in - total,
+			     SPLICE_F_MOVE);
+		if (out <= 0)
+			return -1;
+		total += out;
+	}
+
+	return total;
+}
+
+static ssize_t drain_read(struct stream *s)
+{
+	static char buf[CHUNK_SIZE];
+	ssize_t n;
+
+	n = read(s->in, buf, sizeof(buf));
+	if (n <= 0)
+		return n < 0 && errno == EAGAIN ? 0 : n;
+
+	return write_all(s->out, buf, n) ? -1 : n;
+}
+
+/* Copy everything currently readable from @s, returns bytes or -1 */
+static ssize_t drain(struct stream *s)
+{
+	ssize_t n, total = 0;
+
+	for (;;) {
+		if (s->use_splice) {
+			n = drain_splice(s);
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				s->use_splice = 0;
+				continue;
+			}
+		} else {
+			n = drain_read(s);
+		}
+
+		if (n < 0)
+			return -1;
+		if (!n)
+			break;
+		total += n;
+	}
+
+	s->bytes += total;
+
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	static struct stream streams[MAX_CPUS];
+	static struct pollfd fds[MAX_CPUS];
+	char path[PATH_MAX];
+	unsigned long long total = 0;
+	int nr = 0, i, ret;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <debugfs device dir> <output prefix>\n",
+			argv[0]);
+		return 2;
+	}
+
+	ret = write_ctl(argv[1], "1");
+	if (ret) {
+		fprintf(stderr, "cannot start capture: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		struct stream *s = &streams[nr];
+
+		snprintf(path, sizeof(path), "%s/capture%d", argv[1], i);
+		s->in = open(path, O_RDONLY | O_NONBLOCK);
+		if (s->in < 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s.%d", argv[2], i);
+		s->out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (s->out < 0) {
+			perror(path);
+			return 1;
+		}
+
+		s->use_splice = pipe(s->pipe) == 0;
+		fds[nr].fd = s->in;
+		fds[nr].events = POLLIN;
+		nr++;
+	}
+
+	if (!nr) {
+		fprintf(stderr, "no capture buffers in %s\n", argv[1]);
+		write_ctl(argv[1], "0");
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while (!stop) {
+		if (poll(fds, nr, 1000) < 0 && errno != EINTR)
+			break;
+
+		for (i = 0; i < nr; i++)
+			if (drain(&streams[i]) < 0)
+				stop = 1;
+	}
+
+	/* Make the partial sub-buffers readable before closing the channel */
+	write_ctl(argv[1], "flush");
+	for (i = 0; i < nr; i++) {
+		drain(&streams[i]);
+		total += streams[i].bytes;
+		close(streams[i].in);
+		close(streams[i].out);
+	}
+	write_ctl(argv[1], "0");
+
+	fprintf(stderr, "captured %llu reports from %d buffers\n",
+		total / sizeof(struct prismriver_raw_record), nr);
+
+	return 0;
+}
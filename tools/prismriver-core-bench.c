@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Microbenchmark of the report decoder, built from the same source as
+ *  the driver's (libprismriver-core).
+ *
+ *  Usage: prismriver-core-bench [-n rounds] [-t] [capture]
+ *
+ *  Decodes the reports of the capture, or a synthetic strumming pattern
+ *  without one, the way the driver does: decode the dongle's layout, then
+ *  compare with the previous frame. With -t, the layout is decoded by
+ *  executing its field table, as for dongles with another layout, rather
+ *  than through the hard-coded path. Every round goes over all the
+ *  reports; the cost per report of the fastest and the median round is
+ *  printed, in TSC cycles on x86 and in nanoseconds elsewhere.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+#endif
+
+#include "prismriver_core.h"
+#include "capfile.h"
+
+#define SYNTHETIC_REPORTS 4096
+
+static inline uint64_t ticks(void)
+{
+#ifdef UNIT
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#ifndef UNIT
+#define UNIT "ns"
+#endif
+
+/* Frets changing every few reports, strums and a moving whammy */
+static void synthesize(uint8_t *reports, unsigned int count)
+{
+	unsigned int i;
+	uint8_t *rd;
+
+	for (i = 0; i < count; i++) {
+		rd = reports + i * PRISMRIVER_REPORT_SIZE;
+		memset(rd, 0, PRISMRIVER_REPORT_SIZE);
+		rd[0] = 1 << ((i / 8) % 5);
+		rd[2] = i % 16 == 0 ? 4 : 8;
+		rd[5] = i & 0xff;
+		rd[19] = (i * 3) & 0xff;
+		rd[20] = (i >> 6) & 0x3;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	const struct prismriver_layout *layout = &prismriver_default_layout;
+	struct prismriver_layout table = prismriver_default_layout;
+	struct prismriver_frame last = { 0 }, frame;
+	unsigned int rounds = 1000, count, i, r;
+	volatile unsigned int sink = 0;
+	size_t stride = PRISMRIVER_REPORT_SIZE;
+	size_t report_size = PRISMRIVER_REPORT_SIZE;
+	const uint8_t *reports;
+	uint8_t *synthetic = NULL;
+	uint64_t *costs, start;
+	struct cap cap;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "n:t")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = atoi(optarg);
+			if (rounds < 1)
+				goto usage;
+			break;
+		case 't':
+			layout = &table;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind == argc - 1) {
+		ret = cap_load(&cap, argv[optind]);
+		if (!ret && !cap.hdr.count)
+			ret = -EINVAL;
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", argv[optind],
+				strerror(-ret));
+			return 1;
+		}
+		reports = cap_report(&cap, 0);
+		stride = cap_record_size(&cap);
+		report_size = cap.hdr.report_size;
+		count = cap.hdr.count;
+	} else if (optind == argc) {
+		count = SYNTHETIC_REPORTS;
+		synthetic = malloc(count * PRISMRIVER_REPORT_SIZE);
+		if (!synthetic)
+			return 1;
+		synthesize(synthetic, count);
+		reports = synthetic;
+	} else {
+		goto usage;
+	}
+
+	costs = calloc(rounds, sizeof(*costs));
+	if (!costs)
+		return 1;
+
+	for (r = 0; r < rounds; r++) {
+		start = ticks();
+		for (i = 0; i < count; i++) {
+			if (prismriver_decode(layout, reports + i * stride,
+					      report_size, &frame))
+				continue;
+			sink += prismriver_frame_changes(&last, &frame);
+			last = frame;
+		}
+		costs[r] = ticks() - start;
+	}
+
+	qsort(costs, rounds, sizeof(*costs), cmp_u64);
+	printf("reports %u rounds %u\n", count, rounds);
+	printf("min %.2f %s/report\n", (double)costs[0] / count, UNIT);
+	printf("median %.2f %s/report\n", (double)costs[rounds / 2] / count,
+	       UNIT);
+
+	free(costs);
+	free(synthetic);
+	if (!synthetic)
+		cap_free(&cap);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: prismriver-core-bench [-n rounds] [-t] [capture]\n");
+	return 2;
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  libFuzzer target for the report decoder, built with "make fuzz".
+ *
+ *  The input starts with a field table, then is split into reports of
+ *  random sizes, all decoded in turn and compared with the previous
+ *  frame, like the driver does with what comes from the dongle. Decoded
+ *  frames are checked for values the driver never hands out.
+ *
+ *  The table is the dongle's own if the first byte is even; otherwise
+ *  its upper bits give a number of fields, each read from 4 bytes (bit
+ *  offset, width, target and button), standing in for what a hostile
+ *  report descriptor could make the driver build.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "prismriver_core.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct prismriver_layout custom = { 0 };
+	const struct prismriver_layout *layout = &prismriver_default_layout;
+	struct prismriver_frame last = { 0 }, frame;
+	unsigned int len, changes, fields;
+
+	if (!size)
+		return 0;
+
+	if (data[0] & 1) {
+		fields = data[0] >> 1;
+		data++;
+		size--;
+		for (; fields && size >= 4; fields--, data += 4, size -= 4)
+			prismriver_layout_add(&custom, data[0] | data[1] << 8,
+					      data[2] & 0x1f, data[3] & 0x3,
+					      1 << (data[3] >> 5));
+		custom.report_size = custom.size;
+		layout = &custom;
+	}
+
+	while (size) {
+		/* The first byte of each chunk gives the report length */
+		len = data[0];
+		data++;
+		size--;
+		if (len > size)
+			len = size;
+
+		if (!prismriver_decode(layout, data, len, &frame)) {
+			if (frame.strum > PRISMRIVER_STRUM_DOWN ||
+			    frame.tilt > 0x3ff)
+				abort();
+
+			changes = prismriver_frame_changes(&last, &frame);
+			if ((changes & (PRISMRIVER_CHANGED_EDGE |
+					PRISMRIVER_CHANGED_STRUM)) &&
+			    !(changes & PRISMRIVER_CHANGED))
+				abort();
+			last = frame;
+		}
+
+		data += len;
+		size -= len;
+	}
+
+	return 0;
+}
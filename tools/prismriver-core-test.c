@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Checks of the report decoder, run with "make test".
+ *
+ *  Builds a field table from the PS3 guitar dongle's report descriptor
+ *  the way the driver does from the parsed one, and checks that it is
+ *  prismriver_default_layout, so that the driver takes the decoder's
+ *  hard-coded path for the dongle. Then decodes reports through both the
+ *  table and the hard-coded path and checks that they agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prismriver_core.h"
+
+/* Report descriptor of the PS3 guitar dongle, 27 byte input report */
+static const __u8 dongle_rdesc[] = {
+	0x05, 0x01, 0x09, 0x05, 0xa1, 0x01, 0x15, 0x00, 0x25, 0x01,
+	0x35, 0x00, 0x45, 0x01, 0x75, 0x01, 0x95, 0x0d, 0x05, 0x09,
+	0x19, 0x01, 0x29, 0x0d, 0x81, 0x02, 0x95, 0x03, 0x81, 0x01,
+	0x05, 0x01, 0x25, 0x07, 0x46, 0x3b, 0x01, 0x75, 0x04, 0x95,
+	0x01, 0x65, 0x14, 0x09, 0x39, 0x81, 0x42, 0x65, 0x00, 0x95,
+	0x01, 0x81, 0x01, 0x26, 0xff, 0x00, 0x46, 0xff, 0x00, 0x09,
+	0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35, 0x75, 0x08, 0x95,
+	0x04, 0x81, 0x02, 0x06, 0x00, 0xff, 0x09, 0x20, 0x09, 0x21,
+	0x09, 0x22, 0x09, 0x23, 0x09, 0x24, 0x09, 0x25, 0x09, 0x26,
+	0x09, 0x27, 0x09, 0x28, 0x09, 0x29, 0x09, 0x2a, 0x09, 0x2b,
+	0x95, 0x0c, 0x81, 0x02, 0x0a, 0x21, 0x26, 0x95, 0x08, 0xb1,
+	0x02, 0x0a, 0x21, 0x26, 0x91, 0x02, 0x26, 0xff, 0x03, 0x46,
+	0xff, 0x03, 0x09, 0x2c, 0x09, 0x2d, 0x09, 0x2e, 0x09, 0x2f,
+	0x75, 0x10, 0x95, 0x04, 0x81, 0x02, 0xc0,
+};
+
+#define USAGES_MAX 32
+
+static int failed;
+
+#define check(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1;						\
+	}								\
+} while (0)
+
+/*
+ * The part of the HID parser the driver's table depends on: short items,
+ * a single input report without ID, and the usages of variable fields
+ * assigned like hid-core does, the last one repeating.
+ */
+static int build_layout(const __u8 *rd, unsigned int size,
+			struct prismriver_layout *layout)
+{
+	unsigned int page = 0, report_size = 0, report_count = 0;
+	unsigned int usages[USAGES_MAX], n_usages = 0, min = 0;
+	unsigned int offset = 0, i, len, tag, data, usage, target;
+	const __u8 *end = rd + size;
+	__u16 button;
+
+	*layout = (struct prismriver_layout) { 0 };
+
+	for (; rd < end; rd += 1 + len) {
+		len = (rd[0] & 3) == 3 ? 4 : rd[0] & 3;
+		tag = rd[0] & ~3;
+		if (rd + 1 + len > end)
+			return -1;
+
+		data = 0;
+		for (i = 0; i < len; i++)
+			data |= rd[1 + i] << (8 * i);
+
+		switch (tag) {
+		case 0x04:	/* usage page */
+			page = data;
+			break;
+		case 0x74:	/* report size */
+			report_size = data;
+			break;
+		case 0x94:	/* report count */
+			report_count = data;
+			break;
+		case 0x84:	/* report ID */
+			return -1;
+		case 0x08:	/* usage */
+			if (n_usages < USAGES_MAX)
+				usages[n_usages++] = len == 4 ? data :
+						     page << 16 | data;
+			break;
+		case 0x18:	/* usage minimum */
+			min = data;
+			break;
+		case 0x28:	/* usage maximum */
+			for (; min <= data && n_usages < USAGES_MAX; min++)
+				usages[n_usages++] = page << 16 | min;
+			break;
+		case 0x80:	/* input */
+			for (i = 0; i < report_count && !(data & 1) &&
+				    (data & 2) && n_usages; i++) {
+				usage = usages[i < n_usages ? i : n_usages - 1];
+				if (!prismriver_usage_target(usage, &target,
+							     &button))
+					continue;
+				if (prismriver_layout_add(layout,
+							  offset + i * report_size,
+							  report_size, target,
+							  button))
+					return -1;
+			}
+			offset += report_count * report_size;
+			n_usages = 0;
+			break;
+		case 0x90:	/* output */
+		case 0xa0:	/* collection */
+		case 0xb0:	/* feature */
+		case 0xc0:	/* end collection */
+			n_usages = 0;
+			break;
+		}
+	}
+
+	layout->report_size = (offset + 7) / 8;
+	return 0;
+}
+
+static void test_dongle_layout(void)
+{
+	struct prismriver_layout layout;
+
+	check(!build_layout(dongle_rdesc, sizeof(dongle_rdesc), &layout));
+	check(layout.report_size == PRISMRIVER_REPORT_SIZE);
+	check(prismriver_layout_equal(&layout, &prismriver_default_layout));
+}
+
+static void test_decode_paths(void)
+{
+	struct prismriver_layout table = prismriver_default_layout;
+	struct prismriver_frame fast, slow;
+	__u8 rd[PRISMRIVER_REPORT_SIZE];
+	unsigned int i, j;
+
+	srand(1);
+	for (i = 0; i < 100000; i++) {
+		for (j = 0; j < sizeof(rd); j++)
+			rd[j] = rand();
+		/* Mostly valid hat values, with padding bits set */
+		if (i & 1)
+			rd[2] = (rd[2] & 0xf0) | (rd[2] & 0x7);
+
+		check(!prismriver_decode(&prismriver_default_layout, rd,
+					 sizeof(rd), &fast));
+		check(!prismriver_decode(&table, rd, sizeof(rd), &slow));
+		check(fast.buttons == slow.buttons &&
+		      fast.strum == slow.strum &&
+		      fast.whammy == slow.whammy && fast.tilt == slow.tilt);
+		if (failed)
+			return;
+	}
+}
+
+int main(void)
+{
+	test_dongle_layout();
+	test_decode_paths();
+
+	if (failed)
+		return 1;
+	printf("prismriver-core-test: ok\n");
+	return 0;
+}
@@ -0,0 +1,541 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Emulate a guitar dongle at the USB level and stream a capture from it.
+ *
+ *  Usage: prismriver-gadget [-l] [-i interval_ms] [-t timing_file]
+ *                           [-u udc_driver -U udc_device] <capture>
+ *
+ *  Unlike uhid, this goes through the whole USB stack: the host sees a
+ *  real device enumerate, usbhid polls its interrupt endpoint, and the
+ *  driver gets URBs, frame numbers and suspend/resume like with the real
+ *  dongle. Meant for a plain VM with dummy_hcd and raw_gadget:
+ *
+ *	modprobe dummy_hcd
+ *	modprobe raw_gadget
+ *	prismriver-gadget guitar.prcap
+ *
+ *  The device is built from the capture: its vendor and product IDs and
+ *  report descriptor come from the capture header. Once the host has
+ *  configured the device, the reports are sent at their recorded offsets;
+ *  -l loops the capture forever. -t logs the CLOCK_MONOTONIC time at which
+ *  each report was handed to the host, one "index time_ns" line per
+ *  report, for latency measurements against evdev or /dev/prismriverN
+ *  timestamps (the gadget and the host share the clock on dummy_hcd).
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/hid.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "capfile.h"
+
+#define EP0_MAX_DATA 256
+#define EP_MAX_PACKET 64
+
+#define STRING_MANUFACTURER 1
+#define STRING_PRODUCT 2
+
+struct ep0_io {
+	struct usb_raw_ep_io io;
+	uint8_t data[EP0_MAX_DATA];
+};
+
+struct ep_io {
+	struct usb_raw_ep_io io;
+	uint8_t data[EP_MAX_PACKET];
+};
+
+struct event {
+	struct usb_raw_event event;
+	uint8_t data[sizeof(struct usb_ctrlrequest)];
+};
+
+struct hid_class_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint16_t bcdHID;
+	uint8_t bCountryCode;
+	uint8_t bNumDescriptors;
+	uint8_t bReportDescriptorType;
+	uint16_t wReportDescriptorLength;
+} __attribute__((packed));
+
+struct config {
+	struct usb_config_descriptor config;
+	struct usb_interface_descriptor intf;
+	struct hid_class_descriptor hid;
+	struct usb_endpoint_descriptor ep;
+} __attribute__((packed));
+
+struct gadget {
+	int fd;
+	struct cap cap;
+	int loop;
+	FILE *timing;
+	unsigned int interval_ms;
+	struct usb_device_descriptor dev;
+	struct config config;
+	int ep;
+	int streaming;
+	pthread_t streamer;
+	/* Last report sent, answered to GET_REPORT */
+	pthread_mutex_t lock;
+	uint8_t report[EP_MAX_PACKET];
+};
+
+static const char *const strings[] = {
+	[STRING_MANUFACTURER] = "RedOctane",
+	[STRING_PRODUCT] = "Guitar Hero3 for PlayStation (R) 3",
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR && !stop)
+		;
+}
+
+static void build_descriptors(struct gadget *g)
+{
+	const struct prismriver_cap_header *hdr = &g->cap.hdr;
+
+	g->dev = (struct usb_device_descriptor) {
+		.bLength = USB_DT_DEVICE_SIZE,
+		.bDescriptorType = USB_DT_DEVICE,
+		.bcdUSB = htole16(0x0200),
+		.bMaxPacketSize0 = EP_MAX_PACKET,
+		.idVendor = htole16(hdr->vendor),
+		.idProduct = htole16(hdr->product),
+		.bcdDevice = htole16(0x0100),
+		.iManufacturer = STRING_MANUFACTURER,
+		.iProduct = STRING_PRODUCT,
+		.bNumConfigurations = 1,
+	};
+
+	g->config = (struct config) {
+		.config = {
+			.bLength = USB_DT_CONFIG_SIZE,
+			.bDescriptorType = USB_DT_CONFIG,
+			.wTotalLength = htole16(sizeof(g->config)),
+			.bNumInterfaces = 1,
+			.bConfigurationValue = 1,
+			.bmAttributes = USB_CONFIG_ATT_ONE,
+			.bMaxPower = 50,
+		},
+		.intf = {
+			.bLength = USB_DT_INTERFACE_SIZE,
+			.bDescriptorType = USB_DT_INTERFACE,
+			.bNumEndpoints = 1,
+			.bInterfaceClass = USB_CLASS_HID,
+		},
+		.hid = {
+			.bLength = sizeof(struct hid_class_descriptor),
+			.bDescriptorType = HID_DT_HID,
+			.bcdHID = htole16(0x0111),
+			.bNumDescriptors = 1,
+			.bReportDescriptorType = HID_DT_REPORT,
+			.wReportDescriptorLength = htole16(hdr->rdesc_size),
+		},
+		.ep = {
+			.bLength = USB_DT_ENDPOINT_SIZE,
+			.bDescriptorType = USB_DT_ENDPOINT,
+			.bEndpointAddress = USB_DIR_IN | 1,
+			.bmAttributes = USB_ENDPOINT_XFER_INT,
+			.wMaxPacketSize = htole16(EP_MAX_PACKET),
+			.bInterval = g->interval_ms,
+		},
+	};
+}
+
+/* Pick the first UDC endpoint that can do interrupt IN transfers */
+static int find_int_in_ep(struct gadget *g)
+{
+	struct usb_raw_eps_info info;
+	int i, n;
+
+	memset(&info, 0, sizeof(info));
+	n = ioctl(g->fd, USB_RAW_IOCTL_EPS_INFO, &info);
+	if (n < 0)
+		return -errno;
+
+	for (i = 0; i < n; i++) {
+		struct usb_raw_ep_info *ep = &info.eps[i];
+
+		if (!ep->caps.type_int || !ep->caps.dir_in)
+			continue;
+		if (ep->addr != USB_RAW_EP_ADDR_ANY)
+			g->config.ep.bEndpointAddress = USB_DIR_IN | ep->addr;
+		return 0;
+	}
+
+	return -ENODEV;
+}
+
+static void *stream(void *arg)
+{
+	struct gadget *g = arg;
+	const struct cap *cap = &g->cap;
+	struct ep_io out;
+	uint64_t next = now_ns();
+	unsigned long index = 0;
+	uint32_t i;
+
+	out.io.ep = g->ep;
+	out.io.flags = 0;
+	out.io.length = cap->hdr.report_size;
+
+	do {
+		for (i = 0; i < cap->hdr.count && !stop; i++, index++) {
+			/* The first record's delta is relative to nothing */
+			if (i)
+				next += cap_delta_ns(cap, i);
+			sleep_until(next);
+
+			memcpy(out.data, cap_report(cap, i), out.io.length);
+			pthread_mutex_lock(&g->lock);
+			memcpy(g->report, out.data, out.io.length);
+			pthread_mutex_unlock(&g->lock);
+
+			/* Blocks until the host polls the endpoint */
+			if (ioctl(g->fd, USB_RAW_IOCTL_EP_WRITE, &out) < 0) {
+				if (errno != ESHUTDOWN && errno != EINTR)
+					perror("ep write");
+				return NULL;
+			}
+
+			if (g->timing)
+				fprintf(g->timing, "%lu %llu\n", index,
+					(unsigned long long)now_ns());
+		}
+		next = now_ns();
+	} while (g->loop && !stop);
+
+	return NULL;
+}
+
+static int start_streaming(struct gadget *g)
+{
+	int ret;
+
+	if (g->streaming)
+		return 0;
+
+	g->ep = ioctl(g->fd, USB_RAW_IOCTL_EP_ENABLE, &g->config.ep);
+	if (g->ep < 0)
+		return -errno;
+
+	ret = pthread_create(&g->streamer, NULL, stream, g);
+	if (ret)
+		return -ret;
+	g->streaming = 1;
+
+	return 0;
+}
+
+/* Fill io with the reply to a standard or class IN request, or fail */
+static int control_in(struct gadget *g, const struct usb_ctrlrequest *ctrl,
+		      struct ep0_io *io)
+{
+	const char *s;
+	int i, len;
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		if (ctrl->bRequest != USB_REQ_GET_DESCRIPTOR)
+			return -EINVAL;
+
+		switch (le16toh(ctrl->wValue) >> 8) {
+		case USB_DT_DEVICE:
+			memcpy(io->data, &g->dev, sizeof(g->dev));
+			return sizeof(g->dev);
+		case USB_DT_CONFIG:
+			memcpy(io->data, &g->config, sizeof(g->config));
+			return sizeof(g->config);
+		case HID_DT_HID:
+			memcpy(io->data, &g->config.hid, sizeof(g->config.hid));
+			return sizeof(g->config.hid);
+		case HID_DT_REPORT:
+			if (g->cap.hdr.rdesc_size > EP0_MAX_DATA)
+				return -EINVAL;
+			memcpy(io->data, g->cap.rdesc, g->cap.hdr.rdesc_size);
+			return g->cap.hdr.rdesc_size;
+		case USB_DT_STRING:
+			i = le16toh(ctrl->wValue) & 0xff;
+			if (!i) {
+				/* Supported languages: en-US */
+				memcpy(io->data, "\x04\x03\x09\x04", 4);
+				return 4;
+			}
+			if (i >= (int)(sizeof(strings) / sizeof(strings[0])) ||
+			    !strings[i])
+				return -EINVAL;
+
+			s = strings[i];
+			len = strlen(s);
+			io->data[0] = 2 + 2 * len;
+			io->data[1] = USB_DT_STRING;
+			for (i = 0; i < len; i++) {
+				io->data[2 + 2 * i] = s[i];
+				io->data[3 + 2 * i] = 0;
+			}
+			return 2 + 2 * len;
+		}
+		return -EINVAL;
+	case USB_TYPE_CLASS:
+		if (ctrl->bRequest != HID_REQ_GET_REPORT)
+			return -EINVAL;
+
+		pthread_mutex_lock(&g->lock);
+		memcpy(io->data, g->report, g->cap.hdr.report_size);
+		pthread_mutex_unlock(&g->lock);
+		return g->cap.hdr.report_size;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Handle OUT requests. SET_CONFIGURATION brings up the interrupt endpoint;
+ * class requests such as SET_IDLE and SET_REPORT, including the poke
+ * output reports some dongles need, are accepted and ignored.
+ */
+static int control_out(struct gadget *g, const struct usb_ctrlrequest *ctrl)
+{
+	int ret;
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		switch (ctrl->bRequest) {
+		case USB_REQ_SET_CONFIGURATION:
+			ret = start_streaming(g);
+			if (ret)
+				return ret;
+			ioctl(g->fd, USB_RAW_IOCTL_VBUS_DRAW,
+			      g->config.config.bMaxPower);
+			if (ioctl(g->fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+				return -errno;
+			return 0;
+		case USB_REQ_SET_INTERFACE:
+			return 0;
+		}
+		return -EINVAL;
+	case USB_TYPE_CLASS:
+	case USB_TYPE_VENDOR:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int handle_control(struct gadget *g, const struct usb_ctrlrequest *ctrl)
+{
+	struct ep0_io io;
+	int ret;
+
+	memset(&io, 0, sizeof(io));
+
+	if (ctrl->bRequestType & USB_DIR_IN) {
+		ret = control_in(g, ctrl, &io);
+		if (ret < 0)
+			goto stall;
+
+		io.io.length = ret < le16toh(ctrl->wLength) ?
+			       ret : le16toh(ctrl->wLength);
+		if (ioctl(g->fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+			return -errno;
+		return 0;
+	}
+
+	ret = control_out(g, ctrl);
+	if (ret < 0)
+		goto stall;
+
+	/* Acknowledge, reading any data stage */
+	io.io.length = le16toh(ctrl->wLength);
+	if (io.io.length > EP0_MAX_DATA)
+		io.io.length = EP0_MAX_DATA;
+	if (ioctl(g->fd, USB_RAW_IOCTL_EP0_READ, &io) < 0)
+		return -errno;
+
+	return 0;
+
+stall:
+	if (ioctl(g->fd, USB_RAW_IOCTL_EP0_STALL, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int run(struct gadget *g, const char *udc_driver, const char *udc_device)
+{
+	struct usb_raw_init init;
+	struct event ev;
+	int ret;
+
+	memset(&init, 0, sizeof(init));
+	snprintf((char *)init.driver_name, sizeof(init.driver_name), "%s",
+		 udc_driver);
+	snprintf((char *)init.device_name, sizeof(init.device_name), "%s",
+		 udc_device);
+	init.speed = USB_SPEED_FULL;
+
+	if (ioctl(g->fd, USB_RAW_IOCTL_INIT, &init) < 0 ||
+	    ioctl(g->fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		return -errno;
+
+	while (!stop) {
+		ev.event.type = 0;
+		ev.event.length = sizeof(ev.data);
+		if (ioctl(g->fd, USB_RAW_IOCTL_EVENT_FETCH, &ev) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		switch (ev.event.type) {
+		case USB_RAW_EVENT_CONNECT:
+			ret = find_int_in_ep(g);
+			if (ret)
+				return ret;
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			ret = handle_control(g,
+				(struct usb_ctrlrequest *)ev.event.data);
+			if (ret)
+				return ret;
+			break;
+		default:
+			/* Reset, disconnect, suspend and resume, where reported */
+			fprintf(stderr, "event %u\n", ev.event.type);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: prismriver-gadget [-l] [-i interval_ms] [-t timing_file]\n"
+		"                         [-u udc_driver -U udc_device] <capture>\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *udc_driver = "dummy_udc", *udc_device = "dummy_udc.0";
+	struct gadget g = {
+		.interval_ms = 10,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct sigaction sa;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "li:t:u:U:")) != -1) {
+		switch (opt) {
+		case 'l':
+			g.loop = 1;
+			break;
+		case 'i':
+			g.interval_ms = atoi(optarg);
+			if (g.interval_ms < 1 || g.interval_ms > 255)
+				usage();
+			break;
+		case 't':
+			g.timing = fopen(optarg, "w");
+			if (!g.timing) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'u':
+			udc_driver = optarg;
+			break;
+		case 'U':
+			udc_device = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	ret = cap_load(&g.cap, argv[optind]);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	if (!g.cap.hdr.count || g.cap.hdr.report_size > EP_MAX_PACKET) {
+		fprintf(stderr, "%s: no reports to stream\n", argv[optind]);
+		return 1;
+	}
+	memcpy(g.report, cap_report(&g.cap, 0), g.cap.hdr.report_size);
+	build_descriptors(&g);
+
+	g.fd = open("/dev/raw-gadget", O_RDWR);
+	if (g.fd < 0) {
+		perror("/dev/raw-gadget");
+		return 1;
+	}
+
+	/* No SA_RESTART, so that signals interrupt the blocking ioctls */
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ret = run(&g, udc_driver, udc_device);
+	if (ret)
+		fprintf(stderr, "gadget: %s\n", strerror(-ret));
+
+	/* Kick the streamer out of a pending endpoint write */
+	stop = 1;
+	if (g.streaming) {
+		pthread_kill(g.streamer, SIGINT);
+		pthread_join(g.streamer, NULL);
+	}
+	close(g.fd);
+	if (g.timing)
+		fclose(g.timing);
+	cap_free(&g.cap);
+
+	return ret ? 1 : 0;
+}
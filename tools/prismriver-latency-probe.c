@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Example libprismriver consumer: measure how late events reach userspace.
+ *
+ *  Usage: prismriver-latency-probe [-b] [-n events] [device]
+ *
+ *  Consumes events of the guitar (default /dev/prismriver0) from the
+ *  shared ring and, for each one, takes the time from its timestamp to
+ *  the moment it was consumed. With -b it spins on the ring instead of
+ *  waiting for wakeups, which is what the busy_poll attribute is for.
+ *  After -n events (default 1000) or on SIGINT it prints percentiles and
+ *  the current guitar state, with its time in CLOCK_REALTIME.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libprismriver.h"
+#include "bench.h"
+
+#define BATCH 32
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/dev/prismriver0";
+	struct prismriver_event evs[BATCH];
+	struct prismriver_frame frame;
+	struct prismriver_clock rt;
+	struct prismriver pr;
+	struct lat lat = { 0 };
+	unsigned long target = 1000;
+	uint64_t now, time_ns;
+	int busy = 0, opt, n, i;
+	struct timespec ts;
+	char buf[64];
+
+	while ((opt = getopt(argc, argv, "bn:")) != -1) {
+		switch (opt) {
+		case 'b':
+			busy = 1;
+			break;
+		case 'n':
+			target = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: prismriver-latency-probe [-b] [-n events] [device]\n");
+			return 2;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+
+	n = prismriver_open(&pr, path);
+	if (n) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-n));
+		return 1;
+	}
+	if (busy && !prismriver_busy_poll(&pr))
+		fprintf(stderr, "warning: busy_poll is off for this guitar\n");
+
+	signal(SIGINT, on_signal);
+
+	while (!stop && lat.count < target) {
+		if (busy)
+			n = prismriver_consume(&pr, evs, BATCH);
+		else
+			n = prismriver_wait(&pr, evs, BATCH, 1000);
+		if (n < 0) {
+			if (n == -EINTR)
+				continue;
+			fprintf(stderr, "%s: %s\n", path, strerror(-n));
+			break;
+		}
+
+		now = prismriver_now_ns();
+		for (i = 0; i < n; i++)
+			lat_add(&lat, now - evs[i].time_ns);
+	}
+
+	printf("events %zu lost %llu\n", lat.count,
+	       (unsigned long long)pr.lost);
+	printf("p50 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n",
+	       lat_percentile(&lat, 50) / 1000.0,
+	       lat_percentile(&lat, 99) / 1000.0,
+	       lat_percentile(&lat, 99.9) / 1000.0,
+	       lat_percentile(&lat, 100) / 1000.0);
+
+	if (!prismriver_sample(&pr, &frame, &time_ns) &&
+	    !prismriver_clock_init(&rt, CLOCK_REALTIME)) {
+		ts = prismriver_ns_to_timespec(prismriver_clock_convert(&rt,
+								       time_ns));
+		strftime(buf, sizeof(buf), "%H:%M:%S", localtime(&ts.tv_sec));
+		printf("state at %s.%06ld: buttons 0x%02x strum %u whammy %u tilt %u\n",
+		       buf, ts.tv_nsec / 1000, frame.buttons, frame.strum,
+		       frame.whammy, frame.tilt);
+	}
+
+	lat_free(&lat);
+	prismriver_close(&pr);
+
+	return 0;
+}
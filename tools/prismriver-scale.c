@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  Measure how the driver's cost scales with the number of guitars.
+ *
+ *  Usage: prismriver-scale [-n counts] [-r rate_hz] [-d seconds]
+ *                          [-f factor] <capture>
+ *
+ *  For each guitar count (default 1,4,16,64), creates that many simulated
+ *  dongles through uhid, bound to the prismriver driver, and replays the
+ *  reports of the capture on all of them at once through their debugfs
+ *  report injector, at a fixed rate (default 1000 Hz, -r 8000 for the
+ *  synthetic 8 kHz mode) for -d seconds. It then prints, per count:
+ *
+ *    - driver cycles per report, from the driver's debugfs cost counters
+ *    - hardirq and softirq time per report, from /proc/stat. The
+ *      injector feeds the reports from a softirq hrtimer, so the driver's
+ *      work on them is accounted as softirq, as it is for usbhid's URB
+ *      completions on a real dongle
+ *    - evdev delivery latency percentiles: from the input event timestamp
+ *      to the moment the benchmark read the event
+ *
+ *  Exits with status 1 if cycles per report at any count exceed those of
+ *  the smallest count by more than the factor given with -f (default
+ *  1.5), i.e. if the total cost grows superlinearly with the guitars.
+ *
+ *  Needs root, uhid, debugfs mounted on /sys/kernel/debug, and the driver
+ *  loaded with no other driver claiming the dongle IDs.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define DEBUGFS_DIR "/sys/kernel/debug/prismriver"
+#define DRIVER_NAME "sony"
+#define MAX_GUITARS 256
+#define BIND_TIMEOUT_MS 5000
+/* Time left after the replay for the last events to come through */
+#define SETTLE_NS 200000000ULL
+
+struct cost {
+	uint64_t reports;
+	uint64_t cycles;
+};
+
+struct result {
+	int guitars;
+	uint64_t reports;
+	uint64_t events;
+	double cycles_per_report;
+	double irq_ns_per_report;
+	double softirq_ns_per_report;
+	uint64_t p50, p99, p999;
+};
+
+static int read_cost(const char *hid_id, struct cost *cost)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int n;
+
+	snprintf(path, sizeof(path), DEBUGFS_DIR "/%s/cost", hid_id);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	n = fscanf(f, "reports %llu cycles %llu",
+		   (unsigned long long *)&cost->reports,
+		   (unsigned long long *)&cost->cycles);
+	fclose(f);
+
+	return n == 2 ? 0 : -EIO;
+}
+
+/* The capture's reports, looped at a fixed rate for the whole run */
+static int build_replay(struct cap *replay, const struct cap *cap,
+			unsigned int rate, unsigned int seconds)
+{
+	uint64_t i, count = (uint64_t)rate * seconds;
+	int ret;
+
+	ret = cap_init(replay, cap->hdr.bus, cap->hdr.vendor, cap->hdr.product,
+		       cap->rdesc, cap->hdr.rdesc_size, cap->hdr.report_size);
+	for (i = 0; !ret && i < count; i++)
+		ret = cap_append(replay, i ? 1000000000ULL / rate : 0,
+				 cap_report(cap, i % cap->hdr.count));
+
+	return ret;
+}
+
+static int run(int guitars, const struct cap *cap, const struct cap *replay,
+	       unsigned int seconds, struct result *res)
+{
+	struct simdev devs[MAX_GUITARS];
+	struct pollfd pfds[MAX_GUITARS];
+	struct cost before[MAX_GUITARS], after;
+	uint64_t irq0, soft0, irq1, soft1, end;
+	struct lat lat = { 0 };
+	char uniq[64], path[PATH_MAX];
+	uint64_t cycles = 0;
+	int i, n = 0, ret;
+
+	memset(res, 0, sizeof(*res));
+	res->guitars = guitars;
+
+	for (; n < guitars; n++) {
+		snprintf(uniq, sizeof(uniq), "scale-%d-%d", guitars, n);
+		ret = simdev_create(&devs[n], cap, uniq, BIND_TIMEOUT_MS);
+		if (ret)
+			goto out;
+		if (strcmp(devs[n].driver, DRIVER_NAME)) {
+			fprintf(stderr, "%s: bound to %s, not %s\n",
+				devs[n].hid_id, devs[n].driver, DRIVER_NAME);
+			n++;
+			ret = -ENODEV;
+			goto out;
+		}
+		ret = read_cost(devs[n].hid_id, &before[n]);
+		if (ret) {
+			n++;
+			goto out;
+		}
+		pfds[n].fd = devs[n].evdev;
+		pfds[n].events = POLLIN;
+		evdev_drain(devs[n].evdev, NULL);
+	}
+
+	ret = cpu_irq_time(&irq0, &soft0);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < guitars; i++) {
+		snprintf(path, sizeof(path), DEBUGFS_DIR "/%s/inject",
+			 devs[i].hid_id);
+		ret = cap_save(replay, path);
+		if (ret)
+			goto out;
+	}
+
+	end = now_ns() + seconds * 1000000000ULL + SETTLE_NS;
+	while (now_ns() < end) {
+		if (poll(pfds, guitars, 100) < 0 && errno != EINTR) {
+			ret = -errno;
+			goto out;
+		}
+		for (i = 0; i < guitars; i++)
+			if (pfds[i].revents & POLLIN)
+				res->events += evdev_drain(devs[i].evdev, &lat);
+	}
+
+	ret = cpu_irq_time(&irq1, &soft1);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < guitars; i++) {
+		ret = read_cost(devs[i].hid_id, &after);
+		if (ret)
+			goto out;
+		res->reports += after.reports - before[i].reports;
+		cycles += after.cycles - before[i].cycles;
+	}
+
+	if (res->reports) {
+		res->cycles_per_report = (double)cycles / res->reports;
+		res->irq_ns_per_report = (double)(irq1 - irq0) / res->reports;
+		res->softirq_ns_per_report =
+			(double)(soft1 - soft0) / res->reports;
+	}
+	res->p50 = lat_percentile(&lat, 50);
+	res->p99 = lat_percentile(&lat, 99);
+	res->p999 = lat_percentile(&lat, 99.9);
+
+out:
+	while (n--)
+		simdev_destroy(&devs[n]);
+	lat_free(&lat);
+
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: prismriver-scale [-n counts] [-r rate_hz] [-d seconds]\n"
+		"                        [-f factor] <capture>\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int counts[16] = { 1, 4, 16, 64 }, ncounts = 4;
+	unsigned int rate = 1000, seconds = 10;
+	double factor = 1.5, base;
+	struct result res[16];
+	struct cap cap, replay;
+	char *s, *tok;
+	int opt, i, ret, fail = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:d:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			ncounts = 0;
+			for (s = optarg; (tok = strsep(&s, ",")); ) {
+				if (ncounts == 16)
+					usage();
+				counts[ncounts] = atoi(tok);
+				if (counts[ncounts] < 1 ||
+				    counts[ncounts] > MAX_GUITARS)
+					usage();
+				ncounts++;
+			}
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			if (rate < 1 || rate > 1000000)
+				usage();
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			if (seconds < 1)
+				usage();
+			break;
+		case 'f':
+			factor = atof(optarg);
+			if (factor < 1)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	ret = cap_load(&cap, argv[optind]);
+	if (!ret && !cap.hdr.count)
+		ret = -EINVAL;
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	ret = build_replay(&replay, &cap, rate, seconds);
+	if (ret) {
+		fprintf(stderr, "replay: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	printf("%8s %10s %10s %12s %10s %10s %10s %10s %10s\n", "guitars",
+	       "reports", "events", "cycles/rep", "irq ns", "softirq ns",
+	       "p50 us", "p99 us", "p99.9 us");
+
+	for (i = 0; i < ncounts; i++) {
+		ret = run(counts[i], &cap, &replay, seconds, &res[i]);
+		if (ret) {
+			fprintf(stderr, "%d guitars: %s\n", counts[i],
+				strerror(-ret));
+			return 1;
+		}
+
+		printf("%8d %10llu %10llu %12.0f %10.0f %10.0f %10.1f %10.1f %10.1f\n",
+		       res[i].guitars, (unsigned long long)res[i].reports,
+		       (unsigned long long)res[i].events,
+		       res[i].cycles_per_report, res[i].irq_ns_per_report,
+		       res[i].softirq_ns_per_report, res[i].p50 / 1000.0,
+		       res[i].p99 / 1000.0, res[i].p999 / 1000.0);
+		fflush(stdout);
+	}
+
+	base = res[0].cycles_per_report;
+	for (i = 1; i < ncounts; i++) {
+		if (res[i].cycles_per_report <= base * factor)
+			continue;
+		printf("superlinear: %d guitars cost %.2fx per report of %d\n",
+		       res[i].guitars, res[i].cycles_per_report / base,
+		       res[0].guitars);
+		fail = 1;
+	}
+
+	cap_free(&replay);
+	cap_free(&cap);
+
+	return fail;
+}